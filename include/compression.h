@@ -0,0 +1,49 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <Arduino.h>
+
+// Optional payload compression, applied before encryption for peers that
+// opted in with "set-peer-compression".
+//
+// Payloads to and from such peers start with a header byte:
+//   0xC1 : compressed with static dictionary version 1 (compression_dict.h)
+//   0xC0 : stored as-is (compression did not help)
+// Any other first byte is an uncompressed payload, so plain JSON ('{') needs
+// no header at all.
+//
+// Compressed stream after the header:
+//   0x00-0x7F : literal byte
+//   0x80-0xFD : dictionary entry (code - 0x80)
+//   0xFE xx   : literal byte xx (for bytes >= 0x80, e.g. UTF-8)
+//   0xFF      : reserved
+
+#define COMPRESSION_HEADER_DICT_V1 0xC1
+#define COMPRESSION_HEADER_STORED  0xC0
+
+// Prepare the dictionary (call once during setup)
+void setupCompression();
+
+// Encode a payload for a peer that opted in. Writes the header and the
+// compressed form, or the payload as-is when that is not larger.
+// Returns the encoded length, -1 if it does not fit into outCapacity.
+int encodePayload(const uint8_t* payload, size_t length, uint8_t* out, size_t outCapacity);
+
+// Decode a payload received from a peer that opted in. payload is updated to
+// point at the restored bytes (inside out when they had to be expanded).
+// Returns the payload length, -1 if the stream is malformed or too large.
+int decodePayload(const uint8_t*& payload, size_t length, uint8_t* out, size_t outCapacity);
+
+// Block compression for stored data (log journal), LZSS with a 4 KB window:
+//   control byte, then 8 items – bit n (LSB first) set: match of 2 bytes
+//   (length - 3 : 4 bits | distance : 12 bits), clear: literal byte
+// Blocks are compressed independently and must not exceed 32 KB.
+
+// Compress a block. Called from one task at a time (shared match table).
+// Returns the compressed length, -1 if it does not fit into outCapacity.
+int compressBlock(const uint8_t* in, size_t length, uint8_t* out, size_t outCapacity);
+
+// Returns the restored length, -1 if the block is malformed or too large
+int decompressBlock(const uint8_t* in, size_t length, uint8_t* out, size_t outCapacity);
+
+#endif // COMPRESSION_H
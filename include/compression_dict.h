@@ -0,0 +1,29 @@
+#ifndef COMPRESSION_DICT_H
+#define COMPRESSION_DICT_H
+
+// Static dictionary version 1 (header 0xC1) – shared with the node firmware.
+// Entry n is sent as code 0x80 + n. Never reorder or change entries; append
+// new ones (up to 126) or start a new dictionary version with its own header.
+
+static const char* const COMPRESSION_DICT_V1[] = {
+  // JSON structure
+  "{\"",  "\":\"",  "\",\"",  "\":",  ",\"",  "\"}",  "\"]",  "[\"",  "}}",
+  "true",  "false",  "null",
+  // Common keys
+  "\"type\"",  "\"state\"",  "\"value\"",  "\"status\"",  "\"relay\"",  "\"channel\"",
+  "\"temperature\"",  "\"humidity\"",  "\"pressure\"",  "\"battery\"",  "\"voltage\"",
+  "\"current\"",  "\"power\"",  "\"energy\"",  "\"brightness\"",  "\"color\"",
+  "\"level\"",  "\"mode\"",  "\"name\"",  "\"id\"",  "\"uptime\"",  "\"rssi\"",
+  "\"sensor\"",  "\"switch\"",  "\"light\"",  "\"motion\"",  "\"door\"",  "\"button\"",
+  "\"command\"",  "\"config\"",  "\"data\"",  "\"time\"",  "\"interval\"",  "\"version\"",
+  "\"error\"",  "\"message\"",  "\"scene\"",  "\"position\"",  "\"target\"",
+  // Common values
+  "\"on\"",  "\"off\"",  "\"ok\"",  "\"open\"",  "\"closed\"",  "\"toggle\"",
+  "\"set\"",  "\"get\"",  "\"report\"",  "\"online\"",  "\"offline\"",
+  // Keys without quotes (values, nested text)
+  "state",  "value",  "relay",  "temp",  "sensor",  "00",  "0.",  ".0",  "10",  "20",
+};
+
+#define COMPRESSION_DICT_V1_SIZE (sizeof(COMPRESSION_DICT_V1) / sizeof(COMPRESSION_DICT_V1[0]))
+
+#endif // COMPRESSION_DICT_H
@@ -8,6 +8,52 @@
 
 #define ENABLE_ENCRYPTION 1
 
+// AES implementation: "mbedtls" (ESP32 AES peripheral) or "tiny-aes" (software fallback)
+#define CRYPTO_BACKEND "mbedtls"
+
+// ESP-NOW frame format: 1 = authenticated AES-CCM frames with a counter nonce,
+// 0 = legacy AES-CTR with a random IV. Legacy frames are still accepted on
+// receive while CRYPTO_ACCEPT_LEGACY_CTR is 1.
+#define CRYPTO_SEND_AEAD 0
+#define CRYPTO_ACCEPT_LEGACY_CTR 1
+#define AEAD_TAG_LEN 4
+
+// Key table size for per-peer keys (slot 0 = CRYPTO_KEY, others set with "set-key")
+#define CRYPTO_KEY_SLOTS 8
+
+// Messages larger than one ESP-NOW frame are fragmented up to this size
+#define FRAGMENT_MAX_MESSAGE 2048
+#define FRAGMENT_RX_SLOTS 4
+#define FRAGMENT_TIMEOUT_MS 2000
+
+// Frames for which IV and keystream are precomputed in the idle loop
+#define KEYSTREAM_POOL_SIZE 4
+
+// RAM for the in-memory log shown in the Web UI (oldest lines are dropped first)
+#define LOG_BUFFER_BYTES 8192
+
+// Log records waiting for the log task (power of two)
+#define LOG_QUEUE_SLOTS 32
+
+// Lowest log level compiled in: LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARNING, LOG_LEVEL_ERROR
+// (debug covers per-frame receive/delivery lines and dry-run output)
+#define LOG_LEVEL_MIN LOG_LEVEL_DEBUG
+
+// Log output per sink (runtime changes with "set-log"): minimum level for USB and
+// for the UART2 "log" messages, and the UART2 rate limit (lines per second, 0 = unlimited)
+#define LOG_USB_LEVEL LOG_LEVEL_DEBUG
+#define LOG_UART_LEVEL LOG_LEVEL_INFO
+#define LOG_UART_RATE 10
+#define LOG_UART_BURST 20
+
+// Persistent log journal on LittleFS: minimum level, RAM block written at once,
+// file size and number of files kept, longest time a line waits in RAM
+#define LOG_JOURNAL_LEVEL LOG_LEVEL_INFO
+#define JOURNAL_BLOCK_BYTES 2048
+#define JOURNAL_FILE_BYTES 65536
+#define JOURNAL_FILES 4
+#define JOURNAL_FLUSH_MS 30000
+
 // interval in seconds to send heartbeat message
 #define HEART_BEAT_S 60*60
 
@@ -21,6 +67,32 @@
 // The device will reboot if loop() doesn't execute within this time
 #define WATCHDOG_TIMEOUT_S 30
 
+// UART2 link to the MQTT gateway. UART2_BAUD is the rate used until another one
+// is negotiated with "set-baud", and the rate the link falls back to when the
+// gateway does not confirm a new rate within UART2_BAUD_CONFIRM_MS.
+#define UART2_BAUD 115200
+#define UART2_BAUD_CONFIRM_MS 3000
+
+// ESP-NOW transmit queue
+// Frames waiting for the sender task, and frames sent but not yet confirmed by the send callback
+#define TX_QUEUE_LENGTH 16
+#define TX_MAX_IN_FLIGHT 4
+
+// Number of ESP-NOW devices the transmitter can talk to. Only 20 of them hold an
+// ESP-NOW driver slot at a time; slots are reused least-recently-used first.
+#define PEER_DIRECTORY_SIZE 64
+
+// Replay protection: how far ahead the replay floor of each known peer is
+// reserved in NVS (one write per block), and how many senders outside the
+// directory are tracked
+#define PEER_RX_COUNTER_BLOCK 256
+#define PEER_RX_UNKNOWN_SLOTS 8
+
+// Default retransmission policy on MAC-layer delivery failure (per-peer override via "set-retry")
+#define TX_RETRY_MAX_ATTEMPTS 3     // Total transmissions including the first
+#define TX_RETRY_BACKOFF_MS 20      // First backoff, doubled on every retry (with jitter)
+#define TX_RETRY_BACKOFF_MAX_MS 200
+
 // Wi-Fi Configuration for setup / debugging phase
 #define WIFI_SSID "your-ssid"
 #define WIFI_PASSWORD "your-password"
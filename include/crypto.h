@@ -1,13 +1,86 @@
 #ifndef CRYPTO_H
 #define CRYPTO_H
 #include <Arduino.h>
+#include "peer_directory.h"
+
+// AEAD frame format (AES-CCM): version | 56-bit counter | ciphertext | tag
+#define AEAD_FRAME_VERSION 0xA1
+#define AEAD_HEADER_LEN 8
+#ifndef AEAD_TAG_LEN
+#define AEAD_TAG_LEN 4
+#endif
+#define AEAD_OVERHEAD (AEAD_HEADER_LEN + AEAD_TAG_LEN)
+#define AEAD_MAX_FRAME ESPNOW_FRAME_MAX
+
+// Negative results of frameToPayload()
+#define CRYPTO_ERR_MALFORMED -1
+#define CRYPTO_ERR_AUTH -2
+#define CRYPTO_ERR_REPLAY -3
+
+// Key table: slot 0 is CRYPTO_KEY, slots 1.. are set with "set-key"
+#ifndef CRYPTO_KEY_SLOTS
+#define CRYPTO_KEY_SLOTS 8
+#endif
+
+// Frame protection used with a peer (PeerCrypto::mode)
+enum CryptoMode : uint8_t {
+    CRYPTO_MODE_DEFAULT = 0,  // Follow ENABLE_ENCRYPTION / CRYPTO_SEND_AEAD
+    CRYPTO_MODE_PLAINTEXT,    // Plain payload with a null terminator
+    CRYPTO_MODE_CTR,          // Legacy AES-CTR (IV + ciphertext)
+    CRYPTO_MODE_AEAD          // AES-CCM with frame counter
+};
+
+// Expanded keys of one key slot (internal to crypto.cpp)
+struct CryptoKey;
+
+// AES-CTR implementation selected with CRYPTO_BACKEND ("mbedtls" or "tiny-aes")
+struct CryptoBackend {
+    const char* name;
+    void (*setKey)(CryptoKey& slot);                                                // expand the key schedule once
+    void (*ctrXcrypt)(CryptoKey& slot, const uint8_t* iv, uint8_t* data, size_t length); // encrypt/decrypt in place
+};
+
+// Per-frame cost of one backend measured by benchmarkCrypto()
+struct CryptoBenchResult {
+    const char* name;
+    float usPerFrame;
+};
 
 void setupCrypto();
-void aes_decrypt(uint8_t* encryptedMsg, int encryptedLen, char* decryptedText);
-int aes_encrypt(const char* plainText, uint8_t* encryptedMsg, int maxSize);
-void logMessageToSerial(byte* message, int length, bool isEncrypted);
-int messageToByteArray(const char* charArray, byte* byteArray, bool encrypt, int maxLength = 250);
-void inPlaceDecryptAndLog(byte* message, int length);
-void inPlaceDecrypt(byte* message, int length);
-
-#endif // CRYPOT_H
+// MAC address this device sends from (part of the AEAD nonce) – set when ESP-NOW starts
+void setCryptoLocalMac(const uint8_t* mac);
+// Refill the precomputed keystream pool used by encryptFrame() – call every loop() iteration
+void handleCrypto();
+const CryptoBackend* getCryptoBackend();
+// Time CTR over frameBytes-sized frames for every backend (plus the old per-frame
+// key expansion for reference). Returns the number of results written.
+int benchmarkCrypto(CryptoBenchResult* results, int maxResults, size_t frameBytes, int iterations);
+
+// Store the key of slot 1..CRYPTO_KEY_SLOTS-1 in NVS (length 0 clears the slot).
+// Returns false for slot 0, an invalid slot or length, or when NVS fails.
+bool setCryptoKey(uint8_t slot, const uint8_t* key, size_t length);
+bool isCryptoKeySet(uint8_t slot);
+
+// Names used by the serial API ("default", "plaintext", "ctr", "aead")
+const char* cryptoModeName(uint8_t mode);
+// Returns the CryptoMode for a name, -1 if unknown
+int parseCryptoMode(const char* name);
+
+// Mode and key slot used for a peer, with CRYPTO_MODE_DEFAULT resolved
+PeerCrypto resolvePeerCrypto(const uint8_t* mac);
+
+// Largest payload that fits into a frame of frameCapacity bytes with the given mode
+size_t framePayloadCapacity(const PeerCrypto& crypto, size_t frameCapacity);
+
+// Build the ESP-NOW frame for a payload with the given mode and key slot:
+// AEAD, legacy CTR, or plain with a null terminator.
+// Returns the frame length, -1 if the payload does not fit or the key slot is empty.
+int payloadToFrame(const PeerCrypto& crypto, const uint8_t* payload, size_t length, uint8_t* frame, size_t frameCapacity);
+
+// Recover the payload of a received frame in place (no null termination needed or added),
+// using the mode and key slot configured for the sender.
+// AEAD frames are authenticated and checked against the sender's replay window.
+// Returns the payload length or one of the CRYPTO_ERR_* values.
+int frameToPayload(const uint8_t* senderMac, uint8_t* frame, size_t length, uint8_t*& payload);
+
+#endif // CRYPTO_H
@@ -4,18 +4,78 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <esp_now.h>
+#include "peer_directory.h"
+
+// Maximum length of a serialized correlation ID (including terminator)
+#define ESPNOW_ID_MAX_LEN 32
+
+// Maximum number of targets for one message (array or group size)
+#define ESPNOW_MAX_TARGETS 32
+
+// Maximum length of a group name (including terminator)
+#define ESPNOW_GROUP_NAME_MAX_LEN 16
+
+// Frame size probe (a payload, encrypted like any other):
+//   request: 0xF8 0x01 | frame limit of the sender (2, big-endian) | padding
+//            up to ESPNOW_V1_FRAME_MAX, so the frame itself exceeds the v1 limit
+//   reply:   0xF8 0x02 | frame limit of the peer (2, big-endian)
+// Only v2 peers receive the request; v1 peers drop it and never reply.
+#define PROBE_MARKER 0xF8
+#define PROBE_REQUEST 0x01
+#define PROBE_REPLY 0x02
+
+// Coalesced batch payload: 0xBA | (length | message)...
+// length is 1 byte below 0x80, else 2 bytes (0x80 | high, low)
+#define BATCH_MARKER 0xBA
 
 // Initialize ESP-NOW with error handling and auto-reboot on failure
 // Returns true if initialization was successful
 bool setupEspNow();
 
-// Send a message to a specific peer via ESP-NOW
-// macAddress: 12-character hex string (e.g., "ECFABC2FE867")
-// messageObj: JSON object containing the message to send
-void sendEspNowMessage(const char* macAddress, JsonObject messageObj);
+// Send a message to one or more peers via ESP-NOW
+// The payload is encrypted once and a copy of the frame is queued for the
+// sender task per target; the call returns without waiting for the radio.
+// Targets with a coalescing window collect the message in a batch instead.
+// targets: peer MAC addresses (FF:FF:FF:FF:FF:FF = broadcast)
+// payload: serialized message (JSON text taken as-is from the serial line),
+//          not necessarily null-terminated
+// id:      optional correlation ID as serialized JSON (string or number);
+//          when set, the final outcome per target is reported as a "type":"ack" message
+void sendEspNowMessage(const uint8_t (*targets)[6], int targetCount, const char* payload, size_t length, const char* id = nullptr);
+
+// Send coalesced batches whose window has passed – call every loop() iteration
+void handleEspNowBatches();
+
+// Send a frame size probe to a peer. A v2 peer answers with its frame limit,
+// which is recorded in the peer directory and reported to the gateway as a
+// "probe-peer" response. Returns false if the probe could not be queued or
+// this build has no ESP-NOW v2 support.
+bool probeEspNowPeer(const uint8_t* mac);
+
+// Resolve a "to" field into target MACs. Accepts a 12-hex MAC (FFFFFFFFFFFF
+// = broadcast), a group name or an array of MACs. targets must hold
+// ESPNOW_MAX_TARGETS entries. Returns the number of targets, -1 on error.
+int resolveEspNowTargets(JsonVariantConst to, uint8_t (*targets)[6]);
+
+// Copy the members of a named group into targets (ESPNOW_MAX_TARGETS entries)
+// Returns the member count, -1 if there is no such group
+int getPeerGroupMembers(const char* name, uint8_t (*targets)[6]);
+
+// Create, replace or (with memberCount == 0) delete a named peer group (persists in NVS)
+bool setPeerGroup(const char* name, const uint8_t (*members)[6], int memberCount);
+
+// Load peer groups from NVS (called during setup)
+void loadPeerGroups();
+
+// Report a message that was not transmitted because the device is in Wi-Fi (dry run) mode
+void sendEspNowDryRunAck(const char* id);
+
+// Parse a 12-character hex MAC string (e.g. "ECFABC2FE867") into 6 bytes
+// Returns false if the string is not exactly 12 hex digits
+bool parseMacAddress(const char* macString, uint8_t* macAddress);
 
-// Get the number of registered peers
-uint8_t getEspNowPeerCount();
+// Get the number of known peers (peer directory size, not driver slots)
+uint16_t getEspNowPeerCount();
 
 // Set a custom MAC address (persists in NVS)
 bool setCustomMacAddress(const uint8_t* macAddress);
@@ -0,0 +1,55 @@
+#ifndef FRAGMENTATION_H
+#define FRAGMENTATION_H
+
+#include <Arduino.h>
+
+// Payloads that do not fit into one ESP-NOW frame are split into fragments,
+// each encrypted and sent as a frame of its own.
+//
+// Fragment payload:  0xF7 | message ID (2) | index | count | offset (2) | data
+//   message ID : per-transmitter counter, big-endian
+//   index      : 0 .. count - 1
+//   offset     : position of data in the message, big-endian
+// Every fragment but the last is full, so the receiver can size the message
+// from the first fragment it sees.
+
+#define FRAGMENT_MARKER 0xF7
+#define FRAGMENT_HEADER_LEN 7
+
+// Largest message that is fragmented / reassembled
+#ifndef FRAGMENT_MAX_MESSAGE
+#define FRAGMENT_MAX_MESSAGE 2048
+#endif
+
+// Messages reassembled at the same time; RAM use is
+// FRAGMENT_RX_SLOTS * FRAGMENT_MAX_MESSAGE
+#ifndef FRAGMENT_RX_SLOTS
+#define FRAGMENT_RX_SLOTS 4
+#endif
+
+// A message whose fragments stop arriving is discarded after this time
+#ifndef FRAGMENT_TIMEOUT_MS
+#define FRAGMENT_TIMEOUT_MS 2000
+#endif
+
+#define FRAGMENT_MAX_COUNT 32
+
+// Number of fragments for a message with chunkSize data bytes per fragment,
+// 0 if the message is too large
+int fragmentCount(size_t length, size_t chunkSize);
+
+// Start a new fragmented message and return its ID (called from loop() only)
+uint16_t nextFragmentMessageId();
+
+// Write fragment index of a message into out (FRAGMENT_HEADER_LEN + chunkSize bytes)
+// Returns the fragment length
+size_t buildFragment(const uint8_t* payload, size_t length, size_t chunkSize,
+                     uint16_t messageId, int index, int count, uint8_t* out);
+
+// Add a received fragment (starting with FRAGMENT_MARKER) to the reassembly
+// table. Call from the receive task only. Returns the message length and sets
+// message once the last missing fragment arrived, 0 while fragments are
+// missing, -1 for malformed fragments or when no slot is free.
+int reassembleFragment(const uint8_t* mac, const uint8_t* fragment, size_t length, const uint8_t*& message);
+
+#endif // FRAGMENTATION_H
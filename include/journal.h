@@ -0,0 +1,53 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Persistent log journal on LittleFS, kept across reboots for post-mortem.
+//
+// Log lines are collected in RAM and appended to the current journal file as
+// one block when JOURNAL_BLOCK_BYTES are full, JOURNAL_FLUSH_MS after the
+// first line of the block (a few seconds after an error line), or before a
+// reboot. Files are append-only; after JOURNAL_FILE_BYTES the next file is
+// started and the oldest of JOURNAL_FILES is deleted.
+//
+// Block:  'J' | flags | boot (2) | raw length (2) | stored length (2) | data
+//   flags : bit 0 set = data compressed with compressBlock()
+//   boot  : boot counter, so lines of different boots can be told apart
+// Raw data: one line per entry, "<id> <uptime ms> <level> <text>\n"
+
+#ifndef JOURNAL_BLOCK_BYTES
+#define JOURNAL_BLOCK_BYTES 2048
+#endif
+
+#ifndef JOURNAL_FILE_BYTES
+#define JOURNAL_FILE_BYTES 65536
+#endif
+
+#ifndef JOURNAL_FILES
+#define JOURNAL_FILES 4
+#endif
+
+#ifndef JOURNAL_FLUSH_MS
+#define JOURNAL_FLUSH_MS 30000
+#endif
+
+// Mount LittleFS and find the current journal file (called by setupLogger)
+bool setupJournal();
+
+// Add a line to the pending block (log task only)
+void journalAppend(uint32_t id, uint32_t timestampMs, uint8_t level, const char* line, size_t length);
+
+// Write the pending block if it is due, or in any case when force is set (log task only)
+void journalFlush(bool force);
+
+// Milliseconds until the pending block is due, portMAX_DELAY if there is none
+uint32_t journalFlushDelayMs();
+
+// Fill out with page (0 = newest block), its boot number, the total number of
+// pages and up to limit entries starting at offset ("next_offset" when more
+// follow). Returns false when the page does not exist.
+bool getJournalPage(uint32_t page, size_t offset, size_t limit, JsonObject out);
+
+#endif // JOURNAL_H
@@ -3,37 +3,197 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <type_traits>
+#include "serial_framing.h"
 
 // Initialize logging system (both USB Serial and UART2)
 void setupLogger();
 
 // Send structured JSON message over serial link (UART2) to gateway
+// (wrapped in a FRAME_JSON frame when binary framing is active)
 void sendGatewayMessage(const JsonDocument& doc);
 
-// Log a message to both USB and UART2
-void logPrint(const char* message);
-void logPrint(const String& message);
-void logPrint(int value);
-void logPrint(unsigned int value);
-void logPrint(long value);
-void logPrint(unsigned long value);
-void logPrint(uint8_t value, int format = DEC); // Support HEX format
-
-void logPrintln(const char* message);
-void logPrintln(const String& message);
-void logPrintln(int value);
-void logPrintln(unsigned int value);
-void logPrintln(long value);
-void logPrintln(unsigned long value);
-void logPrintln(uint8_t value, int format = DEC); // Support HEX format
-void logPrintln(); // Empty line
-
-// Printf-style logging
-void logPrintf(const char* format, ...);
+// Forward a payload received over ESP-NOW to the gateway as a "data" message
+// payload: JSON text of the message, not necessarily null-terminated
+void sendGatewayData(const uint8_t* mac, const char* payload, size_t length);
+
+// ---------------------------------------------------------------------------
+// Structured logging
+//
+//   LOG_INFO(LOG_SRC_TRANS, "Peer added: %s", macStr);
+//   LOG_PEER_ERROR(mac, "Dropping malformed fragment");
+//
+// Safe from any task: the call only stores the format string pointer (must be
+// a literal) and a copy of the arguments in a queue. A low-priority log task
+// formats the line and writes it to the in-memory log, USB and UART2.
+// Calls below LOG_LEVEL_MIN are removed at compile time.
+// ---------------------------------------------------------------------------
+
+#define LOG_LEVEL_DEBUG   0
+#define LOG_LEVEL_INFO    1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR   3
+
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN LOG_LEVEL_DEBUG
+#endif
+
+// Where a record comes from ("from" of the UART2 log message is the peer MAC
+// for peer records, WHO_AM_I otherwise)
+enum LogSource : uint8_t {
+  LOG_SRC_TRANS,    // Transmitter firmware
+  LOG_SRC_BUTTON,   // Mode-toggle button
+  LOG_SRC_DRY_RUN,  // Messages not sent while in Wi-Fi mode
+  LOG_SRC_PEER,     // About one ESP-NOW peer (LOG_PEER_* macros)
+  LOG_SRC_LINK,     // Garbled input on UART2, logged as TRANS but never mirrored
+                    // to UART2 (to prevent infinite loopback logging)
+};
+
+// Text that is not null-terminated, logged with "%s"
+struct LogSpan {
+  const char* text;
+  size_t length;
+};
+
+// Copied arguments of one record; strings are truncated when it is full
+#define LOG_ARGS_BYTES 128
+
+enum LogArgType : uint8_t {
+  LOG_ARG_INT32,
+  LOG_ARG_UINT32,
+  LOG_ARG_INT64,
+  LOG_ARG_UINT64,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_POINTER,
+  LOG_ARG_STRING,
+};
+
+struct LogArgs {
+  uint8_t used;       // Bytes of complete arguments in data
+  bool truncated;     // Arguments after used did not fit and print as '?'
+  uint8_t data[LOG_ARGS_BYTES];
+};
+
+// Append one argument (length bytes of value, or a string of length bytes)
+void logPackArg(LogArgs& args, LogArgType type, const void* value, size_t length);
+
+// Queue a record with packed arguments
+void logWrite(uint8_t level, LogSource source, const uint8_t* mac, const char* format, const LogArgs& args);
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type logPack(LogArgs& args, T value) {
+  int64_t wide = (int64_t)value;
+  LogArgType type = std::is_signed<T>::value ? (sizeof(T) <= 4 ? LOG_ARG_INT32 : LOG_ARG_INT64)
+                                             : (sizeof(T) <= 4 ? LOG_ARG_UINT32 : LOG_ARG_UINT64);
+  logPackArg(args, type, &wide, sizeof(wide));
+}
+
+inline void logPack(LogArgs& args, double value) {
+  logPackArg(args, LOG_ARG_DOUBLE, &value, sizeof(value));
+}
+
+inline void logPack(LogArgs& args, const char* value) {
+  value = value != nullptr ? value : "(null)";
+  logPackArg(args, LOG_ARG_STRING, value, strlen(value));
+}
+
+inline void logPack(LogArgs& args, const String& value) {
+  logPackArg(args, LOG_ARG_STRING, value.c_str(), value.length());
+}
+
+inline void logPack(LogArgs& args, const LogSpan& value) {
+  logPackArg(args, LOG_ARG_STRING, value.text, value.length);
+}
+
+inline void logPack(LogArgs& args, const void* value) {
+  uint64_t address = (uintptr_t)value;
+  logPackArg(args, LOG_ARG_POINTER, &address, sizeof(address));
+}
+
+inline void logPackAll(LogArgs& args) {}
+
+template <typename T, typename... Rest>
+inline void logPackAll(LogArgs& args, const T& value, const Rest&... rest) {
+  logPack(args, value);
+  logPackAll(args, rest...);
+}
+
+template <typename... Args>
+inline void logRecord(uint8_t level, LogSource source, const uint8_t* mac, const char* format, const Args&... args) {
+  LogArgs packed;
+  packed.used = 0;
+  packed.truncated = false;
+  logPackAll(packed, args...);
+  logWrite(level, source, mac, format, packed);
+}
+
+#define LOG_DISABLED(...) do {} while (0)
+
+#if LOG_LEVEL_MIN <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(source, ...) logRecord(LOG_LEVEL_DEBUG, source, nullptr, __VA_ARGS__)
+#define LOG_PEER_DEBUG(mac, ...) logRecord(LOG_LEVEL_DEBUG, LOG_SRC_PEER, mac, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISABLED()
+#define LOG_PEER_DEBUG(...) LOG_DISABLED()
+#endif
+
+#if LOG_LEVEL_MIN <= LOG_LEVEL_INFO
+#define LOG_INFO(source, ...) logRecord(LOG_LEVEL_INFO, source, nullptr, __VA_ARGS__)
+#define LOG_PEER_INFO(mac, ...) logRecord(LOG_LEVEL_INFO, LOG_SRC_PEER, mac, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISABLED()
+#define LOG_PEER_INFO(...) LOG_DISABLED()
+#endif
+
+#if LOG_LEVEL_MIN <= LOG_LEVEL_WARNING
+#define LOG_WARN(source, ...) logRecord(LOG_LEVEL_WARNING, source, nullptr, __VA_ARGS__)
+#define LOG_PEER_WARN(mac, ...) logRecord(LOG_LEVEL_WARNING, LOG_SRC_PEER, mac, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISABLED()
+#define LOG_PEER_WARN(...) LOG_DISABLED()
+#endif
+
+#define LOG_ERROR(source, ...) logRecord(LOG_LEVEL_ERROR, source, nullptr, __VA_ARGS__)
+#define LOG_PEER_ERROR(mac, ...) logRecord(LOG_LEVEL_ERROR, LOG_SRC_PEER, mac, __VA_ARGS__)
+
+// Where formatted records go besides the in-memory log (changed with "set-log")
+struct LogSinkConfig {
+  uint8_t usbLevel;    // Minimum level written to USB
+  uint8_t uartLevel;   // Minimum level mirrored to UART2 as "log" messages
+  uint16_t uartRate;   // UART2 log lines per second, 0 = unlimited
+  uint16_t uartBurst;  // UART2 log lines allowed back-to-back
+  uint8_t journalLevel;  // Minimum level kept in the flash journal
+};
+
+LogSinkConfig getLogSinkConfig();
+void setLogSinkConfig(const LogSinkConfig& config);
+
+// Log lines not mirrored to UART2 because of the rate limit, since boot
+uint32_t getUartLogDropped();
+
+// "debug", "info", "warning", "error"; parseLogLevel returns -1 for other names
+const char* logLevelName(uint8_t level);
+int parseLogLevel(const char* name);
+
+// Wait until queued log lines are written, including the journal (before a reboot)
+void flushLogs();
 
 // Get direct access to UART2 for reading incoming messages
 HardwareSerial& getUART2();
 
+// Current UART2 baud rate (UART2_BAUD unless another rate was negotiated)
+uint32_t getUART2Baud();
+
+// Switch UART2 to another baud rate after flushing pending output,
+// optionally storing it in NVS as the rate to use after a reboot
+void setUART2Baud(uint32_t baud, bool persist);
+
+// Switch UART2 output to another framing after flushing pending output
+void setUART2Framing(SerialFraming framing);
+
+// Return to the default rate (UART2_BAUD) and store it in NVS
+void resetUART2Baud();
+
 // Get the logged messages in JSON format for the Web API
 String getLogsJson();
 
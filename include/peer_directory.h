@@ -0,0 +1,123 @@
+#ifndef PEER_DIRECTORY_H
+#define PEER_DIRECTORY_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+
+// Directory of every ESP-NOW device the transmitter talks to.
+//
+// The ESP-NOW driver only holds ESP_NOW_MAX_TOTAL_PEER_NUM registered peers,
+// but the directory can hold many more. Driver slots are used as an LRU cache:
+// a peer is registered right before a frame is sent to it, evicting the least
+// recently used registration when all slots are taken.
+//
+// The directory (MAC, channel, retry policy, encryption, compression, frame
+// size, coalescing) is persisted in NVS and
+// pre-registered with the driver when ESP-NOW starts, so the first command to
+// a known peer after a reboot or mode switch takes the same path as any other.
+//
+// All functions are safe to call from loop() and the ESP-NOW tasks.
+
+// ESP-NOW frame limits: v1 peers accept ESP_NOW_MAX_DATA_LEN (250) bytes,
+// v2 peers (ESP-IDF 5.4 and later) up to ESP_NOW_MAX_DATA_LEN_V2 (1470)
+#define ESPNOW_V1_FRAME_MAX ESP_NOW_MAX_DATA_LEN
+#ifdef ESP_NOW_MAX_DATA_LEN_V2
+#define ESPNOW_FRAME_MAX ESP_NOW_MAX_DATA_LEN_V2
+#else
+#define ESPNOW_FRAME_MAX ESP_NOW_MAX_DATA_LEN
+#endif
+
+// Retransmission policy applied when the MAC layer reports a delivery failure
+struct RetryPolicy {
+  uint8_t maxAttempts;    // Total transmissions including the first one (1 = no retries)
+  uint16_t backoffMs;     // Backoff before the first retransmission, doubled each time
+  uint16_t backoffMaxMs;  // Upper bound for the backoff
+};
+
+// Frame protection for one peer – mode is a CryptoMode (see crypto.h)
+struct PeerCrypto {
+  uint8_t mode;     // CRYPTO_MODE_DEFAULT follows the global configuration
+  uint8_t keySlot;  // Key table slot, 0 = CRYPTO_KEY
+};
+
+// Initialize the directory (call once during setup, before any other function)
+void setupPeerDirectory();
+
+// Load the persisted directory from NVS (called during setup)
+void loadPeerDirectory();
+
+// Write pending directory changes to NVS once they have settled – call every loop() iteration
+void handlePeerDirectory();
+
+// Register the most recently used known peers with the driver (after esp_now_init())
+void registerKnownPeers();
+
+// Make sure the peer is in the directory and return its retry policy
+// Returns false if the directory is full
+bool addPeer(const uint8_t* macAddress, RetryPolicy* retry);
+
+// Make sure the peer holds a driver slot, evicting the least recently used
+// peer if needed. Call right before esp_now_send().
+bool ensurePeerRegistered(const uint8_t* macAddress);
+
+// Forget all driver registrations (the driver table is empty after esp_now_init())
+void resetPeerRegistrations();
+
+// Set the retransmission policy for one peer, or the default policy when
+// macAddress is nullptr. Returns false if the peer could not be added.
+bool setRetryPolicy(const uint8_t* macAddress, const RetryPolicy& policy);
+
+// Get the policy used for a peer (the default policy for unknown peers or nullptr)
+RetryPolicy getRetryPolicy(const uint8_t* macAddress);
+
+// Set the Wi-Fi channel used for a peer (0 = current channel), adding it if needed
+bool setPeerChannel(const uint8_t* macAddress, uint8_t channel);
+
+// Set the encryption mode and key slot for a peer, adding it if needed
+bool setPeerCrypto(const uint8_t* macAddress, const PeerCrypto& crypto);
+
+// Get the encryption settings of a peer (default mode and slot 0 for unknown peers)
+PeerCrypto getPeerCrypto(const uint8_t* macAddress);
+
+// Enable payload compression for a peer (it must understand compression.h), adding it if needed
+bool setPeerCompression(const uint8_t* macAddress, bool enabled);
+
+// Whether payloads to and from a peer are compressed (false for unknown peers)
+bool getPeerCompression(const uint8_t* macAddress);
+
+// Record the largest frame a peer accepts (0 = unknown, treated as the v1
+// limit), adding it if needed
+bool setPeerFrameMax(const uint8_t* macAddress, uint16_t frameMax);
+
+// Largest frame that can be sent to a peer: its recorded limit, capped at
+// ESPNOW_FRAME_MAX, or ESPNOW_V1_FRAME_MAX if none was recorded
+uint16_t getPeerFrameMax(const uint8_t* macAddress);
+
+// Set the coalescing window for a peer (0 = send every message at once), adding it if needed
+bool setPeerCoalescing(const uint8_t* macAddress, uint8_t windowMs);
+
+// Coalescing window of a peer in ms (0 for unknown peers)
+uint8_t getPeerCoalescing(const uint8_t* macAddress);
+
+// Whether a peer is known to parse the fragment, probe and batch payload
+// formats: it takes v2 frames (answered a probe or sent one), or uses
+// compression or coalescing. Payloads to other peers are not escaped.
+bool getPeerFramedFormats(const uint8_t* macAddress);
+
+// Remove a peer from the directory. Returns false if it was not known.
+bool removePeer(const uint8_t* macAddress);
+
+// Replay protection for authenticated frames: accept each frame counter of a
+// sender once, tolerating reordering within the last 64 counters. For a
+// directory peer a floor PEER_RX_COUNTER_BLOCK counters ahead is stored in its
+// own NVS key before a counter beyond the previous floor is accepted, and
+// counters below the stored floor are rejected after a reboot. Senders
+// outside the directory are not added; they are tracked in a small RAM-only
+// table instead. Returns false for replayed or too old frames, or when the
+// floor cannot be stored.
+bool acceptPeerCounter(const uint8_t* macAddress, uint64_t counter);
+
+// Number of devices in the directory (not counting the broadcast address)
+uint16_t getPeerDirectoryCount();
+
+#endif // PEER_DIRECTORY_H
@@ -0,0 +1,66 @@
+#ifndef SERIAL_FRAMING_H
+#define SERIAL_FRAMING_H
+
+#include <Arduino.h>
+
+// Binary framing for the UART2 link, negotiated with the "set-framing" command.
+//
+// Wire format:  COBS( type | TLV... | CRC16 ) 0x00
+//   type  : one of the FRAME_* values below
+//   TLV   : tag (1 byte), length (1 byte if < 0x80, else 0x80|hi, lo), value
+//   CRC16 : CRC-16/CCITT-FALSE over type and TLVs, big-endian
+// COBS removes every 0x00 from the frame so 0x00 can act as the delimiter.
+
+enum SerialFraming {
+  FRAMING_JSON,    // Newline-terminated JSON (default after boot)
+  FRAMING_BINARY   // COBS + CRC16 + TLV frames
+};
+
+// Frame types
+#define FRAME_SEND 0x01   // Gateway -> transmitter: send payload over ESP-NOW
+#define FRAME_JSON 0x02   // Both directions: one JSON message (commands, logs, acks, ...)
+#define FRAME_DATA 0x81   // Transmitter -> gateway: payload received over ESP-NOW
+
+// TLV tags
+#define TLV_MAC     0x01  // 6 raw MAC bytes (repeatable in FRAME_SEND for fan-out)
+#define TLV_GROUP   0x02  // Group name (FRAME_SEND)
+#define TLV_PAYLOAD 0x03  // Opaque payload bytes
+#define TLV_ID      0x04  // Correlation ID as JSON text, e.g. "\"abc\"" or "42"
+#define TLV_JSON    0x05  // JSON text (FRAME_JSON)
+
+// Largest decoded frame (type + TLVs + CRC) – room for a FRAGMENT_MAX_MESSAGE
+// payload of 2048 bytes plus its TLVs
+#define FRAME_MAX_SIZE 2200
+
+// Space needed for the encoded form of a decoded frame of `len` bytes (incl. delimiter)
+#define FRAME_ENCODED_SIZE(len) ((len) + (len) / 254 + 2)
+
+// Current framing mode of the link
+SerialFraming getSerialFraming();
+void setSerialFraming(SerialFraming framing);
+
+// Frame builder
+struct FrameWriter {
+  uint8_t* buffer;
+  size_t capacity;
+  size_t length;
+  bool overflow;
+};
+
+void frameBegin(FrameWriter& writer, uint8_t* buffer, size_t capacity, uint8_t type);
+void frameAddTlv(FrameWriter& writer, uint8_t tag, const void* value, size_t length);
+
+// Append the CRC, COBS-encode into `out` and add the delimiter
+// Returns the number of bytes to put on the wire, 0 on overflow
+size_t frameFinish(FrameWriter& writer, uint8_t* out, size_t outCapacity);
+
+// Decode a received frame in place (without its 0x00 delimiter) and verify the CRC
+// Returns the length of type + TLVs, or -1 if the frame is malformed or corrupted
+int frameDecode(uint8_t* buffer, size_t length);
+
+// Iterate over the TLVs of a decoded frame; start with offset = 1 (after the type)
+// Returns false at the end of the frame or on a truncated TLV
+bool frameNextTlv(const uint8_t* frame, size_t frameLength, size_t& offset,
+                  uint8_t& tag, const uint8_t*& value, size_t& valueLength);
+
+#endif // SERIAL_FRAMING_H
@@ -7,8 +7,8 @@
 // Initialize serial communication
 void setupSerial();
 
-// Check for and read incoming serial messages
-// Returns true if a valid message was received and parsed
+// Take the next complete message received from the gateway (never blocks)
+// Returns true if a valid message was parsed; call again to get the next one
 bool readSerialMessage();
 
 // Get the parsed JSON document
@@ -18,6 +18,6 @@ JsonDocument& getSerialDoc();
 void handleSerialMessage();
 
 // Get peer count for status reporting
-uint8_t getEspNowPeerCount();
+uint16_t getEspNowPeerCount();
 
 #endif // SERIAL_HANDLER_H
@@ -35,29 +35,30 @@ static bool lastRawLevel              = HIGH;
 void setupButton() {
   pinMode(BUTTON_PIN, INPUT_PULLUP); // GPIO 0 already has a hardware pull-up; this is a safe redundant config
   lastRawLevel = digitalRead(BUTTON_PIN);
-  logPrintf("[BTN] Button handler ready on GPIO%d (long-press threshold: %dms)\n",
+  LOG_INFO(LOG_SRC_BUTTON, "Button handler ready on GPIO%d (long-press threshold: %dms)",
             BUTTON_PIN, BUTTON_LONG_PRESS_MS);
 }
 
 static void onShortPress() {
   DeviceState state = getCurrentState();
   if (state == STATE_ESPNOW) {
-    logPrintln("[BTN] Short press – switching to Wi-Fi mode");
+    LOG_INFO(LOG_SRC_BUTTON, "Short press – switching to Wi-Fi mode");
     // Brief white flash on LED 2 to acknowledge
     triggerStripFlash(2, 200, 200, 200, 500);
     transitionToWifi();
   } else {
-    logPrintln("[BTN] Short press – switching to ESP-NOW mode");
+    LOG_INFO(LOG_SRC_BUTTON, "Short press – switching to ESP-NOW mode");
     triggerStripFlash(2, 200, 200, 200, 500);
     transitionToEspNow();
   }
 }
 
 static void onLongPress() {
-  logPrintln("[BTN] Long press – rebooting...");
+  LOG_INFO(LOG_SRC_BUTTON, "Long press – rebooting...");
   // Flash red on all strip LEDs to signal reboot
   triggerStripFlash(2, 220, 0, 0, 200);
   triggerStripFlash(3, 220, 0, 0, 200);
+  flushLogs();
   delay(300);
   ESP.restart();
 }
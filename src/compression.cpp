@@ -0,0 +1,180 @@
+#include "compression.h"
+#include "compression_dict.h"
+
+#define CODE_DICT_FIRST 0x80
+#define CODE_ESCAPE     0xFE
+
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    18
+#define LZ_MAX_DISTANCE 4095
+#define LZ_HASH_SIZE    1024
+
+static_assert(COMPRESSION_DICT_V1_SIZE <= CODE_ESCAPE - CODE_DICT_FIRST, "Dictionary has too many entries");
+
+static uint8_t dictLength[COMPRESSION_DICT_V1_SIZE];
+
+void setupCompression() {
+  for (size_t i = 0; i < COMPRESSION_DICT_V1_SIZE; i++) {
+    dictLength[i] = strlen(COMPRESSION_DICT_V1[i]);
+  }
+}
+
+// Index of the longest dictionary entry at the start of in, -1 if none matches
+static int longestMatch(const uint8_t* in, size_t remaining) {
+  int best = -1;
+  uint8_t bestLength = 1;  // A single byte is never worth a code
+  for (size_t i = 0; i < COMPRESSION_DICT_V1_SIZE; i++) {
+    uint8_t length = dictLength[i];
+    if (length > bestLength && length <= remaining && (uint8_t)COMPRESSION_DICT_V1[i][0] == in[0] &&
+        memcmp(in, COMPRESSION_DICT_V1[i], length) == 0) {
+      best = i;
+      bestLength = length;
+    }
+  }
+  return best;
+}
+
+int encodePayload(const uint8_t* payload, size_t length, uint8_t* out, size_t outCapacity) {
+  // Compressed form, greedy longest match
+  size_t write = 0;
+  if (outCapacity > 0) {
+    out[write++] = COMPRESSION_HEADER_DICT_V1;
+  }
+  size_t read = 0;
+  while (read < length && write < length && write < outCapacity) {
+    int entry = longestMatch(payload + read, length - read);
+    if (entry >= 0) {
+      out[write++] = CODE_DICT_FIRST + entry;
+      read += dictLength[entry];
+    } else if (payload[read] < CODE_DICT_FIRST) {
+      out[write++] = payload[read++];
+    } else if (write + 2 <= outCapacity) {
+      out[write++] = CODE_ESCAPE;
+      out[write++] = payload[read++];
+    } else {
+      break;
+    }
+  }
+  if (read == length && write < length) {
+    return write;
+  }
+
+  // Not smaller – send as-is, with a header only where the first byte could
+  // be mistaken for one
+  bool needsHeader = length > 0 && (payload[0] == COMPRESSION_HEADER_DICT_V1 || payload[0] == COMPRESSION_HEADER_STORED);
+  size_t storedLength = length + (needsHeader ? 1 : 0);
+  if (storedLength > outCapacity) {
+    return -1;
+  }
+  write = 0;
+  if (needsHeader) {
+    out[write++] = COMPRESSION_HEADER_STORED;
+  }
+  memcpy(out + write, payload, length);
+  return storedLength;
+}
+
+int decodePayload(const uint8_t*& payload, size_t length, uint8_t* out, size_t outCapacity) {
+  if (length == 0 || (payload[0] != COMPRESSION_HEADER_DICT_V1 && payload[0] != COMPRESSION_HEADER_STORED)) {
+    return length;
+  }
+  if (payload[0] == COMPRESSION_HEADER_STORED) {
+    payload++;
+    return length - 1;
+  }
+
+  size_t write = 0;
+  for (size_t read = 1; read < length; read++) {
+    uint8_t code = payload[read];
+    if (code < CODE_DICT_FIRST) {
+      if (write >= outCapacity) return -1;
+      out[write++] = code;
+    } else if (code == CODE_ESCAPE) {
+      if (read + 1 >= length || write >= outCapacity) return -1;
+      out[write++] = payload[++read];
+    } else {
+      size_t entry = code - CODE_DICT_FIRST;
+      if (entry >= COMPRESSION_DICT_V1_SIZE || write + dictLength[entry] > outCapacity) return -1;
+      memcpy(out + write, COMPRESSION_DICT_V1[entry], dictLength[entry]);
+      write += dictLength[entry];
+    }
+  }
+
+  payload = out;
+  return write;
+}
+
+static int16_t lzHead[LZ_HASH_SIZE];  // Last position with a given 3-byte hash
+
+static uint16_t lzHash(const uint8_t* in) {
+  return ((in[0] << 6) ^ (in[1] << 3) ^ in[2]) & (LZ_HASH_SIZE - 1);
+}
+
+int compressBlock(const uint8_t* in, size_t length, uint8_t* out, size_t outCapacity) {
+  memset(lzHead, 0xFF, sizeof(lzHead));
+
+  size_t read = 0;
+  size_t write = 0;
+  while (read < length) {
+    if (write >= outCapacity) return -1;
+    size_t control = write++;
+    out[control] = 0;
+
+    for (int bit = 0; bit < 8 && read < length; bit++) {
+      size_t matchLength = 0;
+      size_t distance = 0;
+      if (read + LZ_MIN_MATCH <= length) {
+        uint16_t hash = lzHash(in + read);
+        int candidate = lzHead[hash];
+        lzHead[hash] = read;
+        if (candidate >= 0 && read - candidate <= LZ_MAX_DISTANCE) {
+          size_t limit = length - read < LZ_MAX_MATCH ? length - read : LZ_MAX_MATCH;
+          while (matchLength < limit && in[candidate + matchLength] == in[read + matchLength]) {
+            matchLength++;
+          }
+          distance = read - candidate;
+        }
+      }
+
+      if (matchLength >= LZ_MIN_MATCH) {
+        if (write + 2 > outCapacity) return -1;
+        out[control] |= 1 << bit;
+        out[write++] = ((matchLength - LZ_MIN_MATCH) << 4) | (distance >> 8);
+        out[write++] = distance & 0xFF;
+        // Positions inside the match are candidates for later matches
+        for (size_t k = 1; k < matchLength && read + k + LZ_MIN_MATCH <= length; k++) {
+          lzHead[lzHash(in + read + k)] = read + k;
+        }
+        read += matchLength;
+      } else {
+        if (write >= outCapacity) return -1;
+        out[write++] = in[read++];
+      }
+    }
+  }
+  return write;
+}
+
+int decompressBlock(const uint8_t* in, size_t length, uint8_t* out, size_t outCapacity) {
+  size_t read = 0;
+  size_t write = 0;
+  while (read < length) {
+    uint8_t control = in[read++];
+    for (int bit = 0; bit < 8 && read < length; bit++) {
+      if (control & (1 << bit)) {
+        if (read + 2 > length) return -1;
+        size_t matchLength = (in[read] >> 4) + LZ_MIN_MATCH;
+        size_t distance = ((in[read] & 0x0F) << 8) | in[read + 1];
+        read += 2;
+        if (distance == 0 || distance > write || write + matchLength > outCapacity) return -1;
+        for (size_t k = 0; k < matchLength; k++, write++) {
+          out[write] = out[write - distance];
+        }
+      } else {
+        if (write >= outCapacity) return -1;
+        out[write++] = in[read++];
+      }
+    }
+  }
+  return write;
+}
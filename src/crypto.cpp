@@ -1,113 +1,554 @@
+#include "config.h"  // before crypto.h, which has defaults for some settings
 #include "crypto.h"
 #include <Arduino.h>
-#include "config.h"
 #include "aes.hpp"  // tiny-AES library
+#include "peer_directory.h"
+#include "espnow_handler.h"
+#include "compression.h"
+#include "fragmentation.h"
+#include "logger.h"
+#include <mbedtls/aes.h>
+#include <mbedtls/ccm.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
+#ifndef CRYPTO_BACKEND
+#define CRYPTO_BACKEND "mbedtls"
+#endif
+
+// Frames with precomputed keystream waiting to be encrypted
+#ifndef KEYSTREAM_POOL_SIZE
+#define KEYSTREAM_POOL_SIZE 4
+#endif
+
+// Keystream per pool entry: 15 AES blocks cover the largest ESP-NOW payload behind the IV
+#define KEYSTREAM_BLOCKS 15
+
+// Frame format used for sending: 0 = legacy AES-CTR, 1 = AES-CCM (AEAD)
+#ifndef CRYPTO_SEND_AEAD
+#define CRYPTO_SEND_AEAD 0
+#endif
+
+// Keep accepting legacy AES-CTR frames while the fleet migrates to AEAD
+#ifndef CRYPTO_ACCEPT_LEGACY_CTR
+#define CRYPTO_ACCEPT_LEGACY_CTR 1
+#endif
+
+// Frame counters reserved in NVS at a time – a reboot skips the unused rest,
+// so a counter (and with it a CCM nonce) is never used twice
+#define AEAD_COUNTER_BLOCK 1024
+#define AEAD_NONCE_LEN 13  // Sender MAC (6) + 56-bit frame counter (7)
+
+#define NVS_NAMESPACE "espnow_gw"
+#define NVS_AEAD_COUNTER_KEY "aead_ctr"
+#define NVS_KEYS_KEY "keys"
 
 byte key[32] = CRYPTO_KEY;
 
+// Both backends must produce the same frames as the clients, which use
+// tiny-AES as configured in aes.h (AES_KEYLEN bytes of the key are used)
+#define CRYPTO_KEY_BITS (AES_KEYLEN * 8)
+
+// ---------------------------------------------------------------------------
+// Key table – slot 0 holds CRYPTO_KEY, slots 1.. are set with "set-key" and
+// stored in NVS. Every slot keeps its expanded key schedules, so picking a
+// key per frame is an array index.
+// ---------------------------------------------------------------------------
+
+struct CryptoKey {
+    bool set;
+    uint8_t key[32];
+    mbedtls_aes_context mbedtlsAes;
+    struct AES_ctx tinyAes;
+    mbedtls_ccm_context ccmTx;  // Used from loop() (sending)
+    mbedtls_ccm_context ccmRx;  // Used from the receive task
+};
+
+struct PersistedKey {
+    uint8_t set;
+    uint8_t key[32];
+};
+
+static CryptoKey keys[CRYPTO_KEY_SLOTS];
+
+// Slot 0 never changes. Other slots can be replaced from loop() while the
+// receive task decrypts with them, so the receive task holds this mutex
+// while it uses one of them.
+static SemaphoreHandle_t keyMutex = NULL;
+
+// ---------------------------------------------------------------------------
+// Backends – the key schedule is expanded once in setKey(), so a frame only
+// costs the CTR keystream. ctrXcrypt() is called from the ESP-NOW sender and
+// receive tasks concurrently and must not modify shared state.
+// ---------------------------------------------------------------------------
+
+// mbedTLS – uses the ESP32 AES peripheral (esp_aes) on Arduino-ESP32
+static void mbedtlsSetKey(CryptoKey& slot) {
+    mbedtls_aes_free(&slot.mbedtlsAes);
+    mbedtls_aes_init(&slot.mbedtlsAes);
+    mbedtls_aes_setkey_enc(&slot.mbedtlsAes, slot.key, CRYPTO_KEY_BITS);
+}
+
+static void mbedtlsCtrXcrypt(CryptoKey& slot, const uint8_t* iv, uint8_t* data, size_t length) {
+    uint8_t counter[16];
+    uint8_t streamBlock[16];
+    size_t offset = 0;
+    memcpy(counter, iv, 16);
+    mbedtls_aes_crypt_ctr(&slot.mbedtlsAes, length, &offset, counter, streamBlock, data, data);
+}
+
+// tiny-AES – software fallback
+static void tinyAesSetKey(CryptoKey& slot) {
+    AES_init_ctx(&slot.tinyAes, slot.key);
+}
+
+static void tinyAesCtrXcrypt(CryptoKey& slot, const uint8_t* iv, uint8_t* data, size_t length) {
+    // Copy of the expanded key, the IV is advanced while encrypting
+    struct AES_ctx ctx = slot.tinyAes;
+    AES_ctx_set_iv(&ctx, iv);
+    AES_CTR_xcrypt_buffer(&ctx, data, length);
+}
+
+static const CryptoBackend cryptoBackends[] = {
+    { "mbedtls", mbedtlsSetKey, mbedtlsCtrXcrypt },
+    { "tiny-aes", tinyAesSetKey, tinyAesCtrXcrypt },
+};
+#define CRYPTO_BACKEND_COUNT (sizeof(cryptoBackends) / sizeof(cryptoBackends[0]))
+
+static const CryptoBackend* activeBackend = &cryptoBackends[0];
+
+// ---------------------------------------------------------------------------
+// AEAD (AES-CCM) – frame: version | 56-bit counter | ciphertext | tag
+// The nonce is the sender MAC followed by the counter, the 8 header bytes are
+// authenticated as additional data. Every key slot has separate contexts for
+// the sending side (loop) and the receive task, so both can run at the same
+// time. The frame counter is shared by all keys.
+// ---------------------------------------------------------------------------
+
+static uint8_t localMac[6];
+static uint64_t txCounter = 0;          // Next counter to send
+static uint64_t txCounterReserved = 0;  // First counter not yet reserved in NVS
+static bool txCounterUsed = false;      // An AEAD frame was sent since boot (any peer)
+
+// Store the end of the next counter block before any counter of it is used
+static bool reserveTxCounters() {
+    Preferences preferences;
+    if (!preferences.begin(NVS_NAMESPACE, false)) {
+        return false;
+    }
+    uint64_t reserved = txCounter + AEAD_COUNTER_BLOCK;
+    bool ok = preferences.putULong64(NVS_AEAD_COUNTER_KEY, reserved) == sizeof(uint64_t);
+    preferences.end();
+    if (ok) {
+        txCounterReserved = reserved;
+    }
+    return ok;
+}
+
+static void buildNonce(uint8_t* nonce, const uint8_t* senderMac, const uint8_t* header) {
+    memcpy(nonce, senderMac, 6);
+    memcpy(nonce + 6, header + 1, AEAD_HEADER_LEN - 1);
+}
+
+// Expand the key schedules of a slot for every backend and for CCM
+static void expandKey(CryptoKey& slot) {
+    for (size_t i = 0; i < CRYPTO_BACKEND_COUNT; i++) {
+        cryptoBackends[i].setKey(slot);
+    }
+    mbedtls_ccm_free(&slot.ccmTx);
+    mbedtls_ccm_free(&slot.ccmRx);
+    mbedtls_ccm_init(&slot.ccmTx);
+    mbedtls_ccm_init(&slot.ccmRx);
+    mbedtls_ccm_setkey(&slot.ccmTx, MBEDTLS_CIPHER_ID_AES, slot.key, CRYPTO_KEY_BITS);
+    mbedtls_ccm_setkey(&slot.ccmRx, MBEDTLS_CIPHER_ID_AES, slot.key, CRYPTO_KEY_BITS);
+}
+
 void setupCrypto() {
-    randomSeed(analogRead(0));  // Seed the random number generator
+    keyMutex = xSemaphoreCreateMutex();
+
+    for (size_t i = 0; i < CRYPTO_BACKEND_COUNT; i++) {
+        if (strcmp(cryptoBackends[i].name, CRYPTO_BACKEND) == 0) {
+            activeBackend = &cryptoBackends[i];
+        }
+    }
+    for (int i = 0; i < CRYPTO_KEY_SLOTS; i++) {
+        mbedtls_aes_init(&keys[i].mbedtlsAes);
+        mbedtls_ccm_init(&keys[i].ccmTx);
+        mbedtls_ccm_init(&keys[i].ccmRx);
+    }
+
+    keys[0].set = true;
+    memcpy(keys[0].key, key, sizeof(key));
+    expandKey(keys[0]);
+
+    // Per-peer keys stored with "set-key", and the AEAD counter continues
+    // after the last reserved block
+    static PersistedKey persisted[CRYPTO_KEY_SLOTS];
+    Preferences preferences;
+    if (preferences.begin(NVS_NAMESPACE, true)) {
+        txCounter = preferences.getULong64(NVS_AEAD_COUNTER_KEY, 0);
+        if (preferences.getBytesLength(NVS_KEYS_KEY) == sizeof(persisted)) {
+            preferences.getBytes(NVS_KEYS_KEY, persisted, sizeof(persisted));
+            for (int i = 1; i < CRYPTO_KEY_SLOTS; i++) {
+                if (persisted[i].set) {
+                    keys[i].set = true;
+                    memcpy(keys[i].key, persisted[i].key, sizeof(keys[i].key));
+                    expandKey(keys[i]);
+                }
+            }
+        }
+        preferences.end();
+    }
+    txCounterReserved = txCounter;
 }
 
-void generateRandomIV(uint8_t* iv, size_t length) {
-    for (size_t i = 0; i < length; i++) {
-        iv[i] = random(0, 256);  // Get a random byte (0-255)
+void setCryptoLocalMac(const uint8_t* mac) {
+    memcpy(localMac, mac, 6);
+}
+
+bool setCryptoKey(uint8_t slot, const uint8_t* keyBytes, size_t length) {
+    if (slot == 0 || slot >= CRYPTO_KEY_SLOTS || length > sizeof(keys[slot].key)) {
+        return false;
+    }
+
+    xSemaphoreTake(keyMutex, portMAX_DELAY);
+    CryptoKey& entry = keys[slot];
+    entry.set = length > 0;
+    memset(entry.key, 0, sizeof(entry.key));
+    memcpy(entry.key, keyBytes, length);
+    if (entry.set) {
+        expandKey(entry);
+    }
+    xSemaphoreGive(keyMutex);
+
+    static PersistedKey persisted[CRYPTO_KEY_SLOTS];
+    memset(persisted, 0, sizeof(persisted));
+    for (int i = 1; i < CRYPTO_KEY_SLOTS; i++) {
+        persisted[i].set = keys[i].set;
+        memcpy(persisted[i].key, keys[i].key, sizeof(persisted[i].key));
     }
+
+    Preferences preferences;
+    if (!preferences.begin(NVS_NAMESPACE, false)) {
+        return false;
+    }
+    bool ok = preferences.putBytes(NVS_KEYS_KEY, persisted, sizeof(persisted)) == sizeof(persisted);
+    preferences.end();
+    return ok;
 }
 
-// **AES-CTR Decrypt (Extract IV & Ciphertext)**
-void aes_decrypt(uint8_t* encryptedMsg, int encryptedLen, char* decryptedText) {
-    if (encryptedLen < 16) return;
+bool isCryptoKeySet(uint8_t slot) {
+    return slot < CRYPTO_KEY_SLOTS && keys[slot].set;
+}
 
-    uint8_t iv[16];
-    memcpy(iv, encryptedMsg, 16);  // Extract IV
+static const char* const cryptoModeNames[] = { "default", "plaintext", "ctr", "aead" };
 
-    int cipherLen = encryptedLen - 16;
-    struct AES_ctx ctx;
-    AES_init_ctx_iv(&ctx, key, iv);
-    AES_CTR_xcrypt_buffer(&ctx, encryptedMsg + 16, cipherLen);
+const char* cryptoModeName(uint8_t mode) {
+    return mode <= CRYPTO_MODE_AEAD ? cryptoModeNames[mode] : "unknown";
+}
 
-    memcpy(decryptedText, encryptedMsg + 16, cipherLen);
-    decryptedText[cipherLen] = '\0';  // Null-terminate string
+int parseCryptoMode(const char* name) {
+    for (int mode = CRYPTO_MODE_DEFAULT; mode <= CRYPTO_MODE_AEAD; mode++) {
+        if (name != nullptr && strcmp(name, cryptoModeNames[mode]) == 0) {
+            return mode;
+        }
+    }
+    return -1;
 }
 
-// **AES-CTR Encrypt and Pack (IV + Ciphertext)**
-int aes_encrypt(const char* plainText, uint8_t* encryptedMsg, int maxSize) {
-    int len = strlen(plainText);
-    if (len + 16 > maxSize) return -1;  // Ensure it fits within ESP-NOW size
+PeerCrypto resolvePeerCrypto(const uint8_t* mac) {
+    PeerCrypto crypto = getPeerCrypto(mac);
+    if (crypto.mode == CRYPTO_MODE_DEFAULT) {
+        crypto.mode = !ENABLE_ENCRYPTION ? CRYPTO_MODE_PLAINTEXT : CRYPTO_SEND_AEAD ? CRYPTO_MODE_AEAD : CRYPTO_MODE_CTR;
+    }
+    return crypto;
+}
+
+// ---------------------------------------------------------------------------
+// Keystream pool – handleCrypto() draws IVs and runs CTR over zeros ahead of
+// time, so encryptFrame() only has to copy the IV and XOR. Each entry is used
+// for exactly one frame. Filled and consumed from loop() only, for the key in
+// slot 0 (peers with their own key compute the keystream on demand).
+// ---------------------------------------------------------------------------
 
+struct KeystreamSlot {
+    bool ready;
     uint8_t iv[16];
-    generateRandomIV(iv, 16);
+    uint8_t stream[KEYSTREAM_BLOCKS * 16];
+};
+
+static KeystreamSlot keystreamPool[KEYSTREAM_POOL_SIZE];
+
+void generateRandomIV(uint8_t* iv, size_t length) {
+    esp_fill_random(iv, length);  // Hardware RNG
+}
+
+void handleCrypto() {
+    // Reserve the next counter block ahead of time, keeping NVS writes off the send path
+    // (also for peers switched to AEAD with "set-peer-crypto")
+    if (txCounterUsed && txCounterReserved - txCounter < AEAD_COUNTER_BLOCK / 4) {
+        reserveTxCounters();
+    }
 
-    struct AES_ctx ctx;
-    AES_init_ctx_iv(&ctx, key, iv);
-    AES_CTR_xcrypt_buffer(&ctx, (uint8_t*)plainText, len);
+    // One keystream entry per call keeps loop() iterations short
+    for (int i = 0; i < KEYSTREAM_POOL_SIZE; i++) {
+        KeystreamSlot& slot = keystreamPool[i];
+        if (!slot.ready) {
+            generateRandomIV(slot.iv, 16);
+            memset(slot.stream, 0, sizeof(slot.stream));
+            activeBackend->ctrXcrypt(keys[0], slot.iv, slot.stream, sizeof(slot.stream));
+            slot.ready = true;
+            return;
+        }
+    }
+}
 
-    // **Pack IV + Ciphertext into one message**
-    memcpy(encryptedMsg, iv, 16);
-    memcpy(encryptedMsg + 16, plainText, len);
+// Take a precomputed entry that covers length bytes, nullptr if none is ready
+static KeystreamSlot* takeKeystream(size_t length) {
+    if (length > KEYSTREAM_BLOCKS * 16) {
+        return nullptr;
+    }
+    for (int i = 0; i < KEYSTREAM_POOL_SIZE; i++) {
+        if (keystreamPool[i].ready) {
+            keystreamPool[i].ready = false;
+            return &keystreamPool[i];
+        }
+    }
+    return nullptr;
+}
 
-    return len + 16;  // Total size (IV + Ciphertext)
+const CryptoBackend* getCryptoBackend() {
+    return activeBackend;
 }
 
-void logMessageToSerial(byte* message, int length, bool isEncrypted) {
-    if (isEncrypted) {
-        Serial.print("Encrypted message ");
-        Serial.print(length);
-        Serial.print(" bytes: ");
-        for (int i = 0; i < length; i++) {
-            Serial.print(message[i], HEX);
-            Serial.print(" ");
+int benchmarkCrypto(CryptoBenchResult* results, int maxResults, size_t frameBytes, int iterations) {
+    uint8_t iv[16] = {0};
+    uint8_t frame[250];
+    if (frameBytes > sizeof(frame)) {
+        frameBytes = sizeof(frame);
+    }
+    memset(frame, 0xA5, sizeof(frame));
+
+    int count = 0;
+    for (size_t i = 0; i < CRYPTO_BACKEND_COUNT && count < maxResults; i++) {
+        int64_t start = esp_timer_get_time();
+        for (int n = 0; n < iterations; n++) {
+            iv[15] = n;
+            cryptoBackends[i].ctrXcrypt(keys[0], iv, frame, frameBytes);
         }
-        Serial.println();
-    } else {
-        Serial.print("Plain message: ");
-        Serial.println((char*)message);
-    }
-}
-
-int messageToByteArray(const char* charArray, byte* byteArray, bool encrypt, int maxLength) {
-    int length = strlen(charArray);
-    if (encrypt) {
-        int encryptedLen = aes_encrypt(charArray, byteArray, maxLength);
-        if (encryptedLen == -1) {
-            Serial.print("[TRANS] Message too long - ");
-            Serial.print(length);
-            Serial.print(", max ");
-            Serial.print(maxLength-16);
-            Serial.println(" bytes allowed when encrypted");
-            return -1;
+        results[count].name = cryptoBackends[i].name;
+        results[count].usPerFrame = (float)(esp_timer_get_time() - start) / iterations;
+        count++;
+    }
+
+    // Previous implementation for reference: key expansion on every frame
+    if (count < maxResults) {
+        int64_t start = esp_timer_get_time();
+        for (int n = 0; n < iterations; n++) {
+            iv[15] = n;
+            struct AES_ctx ctx;
+            AES_init_ctx_iv(&ctx, key, iv);
+            AES_CTR_xcrypt_buffer(&ctx, frame, frameBytes);
         }
-        return encryptedLen;
-    } else {
-        if (length > maxLength) {
-            Serial.print("[TRANS] Message too long - ");
-            Serial.print(length);
-            Serial.print(", max ");
-            Serial.print(maxLength);
-            Serial.println(" bytes allowed");
+        results[count].name = "tiny-aes-rekey";
+        results[count].usPerFrame = (float)(esp_timer_get_time() - start) / iterations;
+        count++;
+    }
+    return count;
+}
+
+// **AES-CTR Decrypt in place (IV + Ciphertext)**
+static int decryptFrame(CryptoKey& slot, uint8_t* frame, size_t length, uint8_t*& plain) {
+    if (length < 16) return -1;
+
+    // The first 16 bytes are the IV, the ciphertext behind it becomes the plaintext
+    size_t cipherLen = length - 16;
+    activeBackend->ctrXcrypt(slot, frame, frame + 16, cipherLen);
+
+    plain = frame + 16;
+    return cipherLen;
+}
+
+// **AES-CTR Encrypt and Pack (IV + Ciphertext)**
+static int encryptFrame(CryptoKey& slot, const uint8_t* plain, size_t length, uint8_t* out, size_t outCapacity) {
+    if (length + 16 > outCapacity) return -1;  // Ensure it fits within ESP-NOW size
+
+    // Fast path: IV and keystream were prepared while idle
+    KeystreamSlot* precomputed = &slot == &keys[0] ? takeKeystream(length) : nullptr;
+    if (precomputed != nullptr) {
+        memcpy(out, precomputed->iv, 16);
+        for (size_t i = 0; i < length; i++) {
+            out[16 + i] = plain[i] ^ precomputed->stream[i];
+        }
+        return length + 16;
+    }
+
+    // Encrypted in the output buffer, the input stays untouched
+    generateRandomIV(out, 16);
+    memcpy(out + 16, plain, length);
+    activeBackend->ctrXcrypt(slot, out, out + 16, length);
+
+    return length + 16;  // Total size (IV + Ciphertext)
+}
+
+static int encryptFrameAead(CryptoKey& slot, const uint8_t* plain, size_t length, uint8_t* out, size_t outCapacity) {
+    if (length + AEAD_OVERHEAD > outCapacity) return -1;
+
+    // Never send a counter that is not covered by NVS
+    if (txCounter >= txCounterReserved && !reserveTxCounters()) {
+        LOG_ERROR(LOG_SRC_TRANS, "Cannot reserve AEAD frame counters in NVS");
+        return -1;
+    }
+    uint64_t counter = txCounter++;
+    txCounterUsed = true;
+
+    out[0] = AEAD_FRAME_VERSION;
+    for (int i = 1; i < AEAD_HEADER_LEN; i++) {
+        out[i] = counter >> (8 * (AEAD_HEADER_LEN - 1 - i));
+    }
+
+    uint8_t nonce[AEAD_NONCE_LEN];
+    buildNonce(nonce, localMac, out);
+    mbedtls_ccm_encrypt_and_tag(&slot.ccmTx, length, nonce, AEAD_NONCE_LEN, out, AEAD_HEADER_LEN,
+                                plain, out + AEAD_HEADER_LEN, out + AEAD_HEADER_LEN + length, AEAD_TAG_LEN);
+    return length + AEAD_OVERHEAD;
+}
+
+static int decryptFrameAead(CryptoKey& slot, const uint8_t* senderMac, uint8_t* frame, size_t length,
+                            uint8_t*& plain, uint64_t& counter) {
+    if (length < AEAD_OVERHEAD || frame[0] != AEAD_FRAME_VERSION) return -1;
+
+    size_t cipherLen = length - AEAD_OVERHEAD;
+    uint8_t nonce[AEAD_NONCE_LEN];
+    buildNonce(nonce, senderMac, frame);
+
+    // The tag is checked before anything else looks at the payload
+    uint8_t* cipher = frame + AEAD_HEADER_LEN;
+    if (mbedtls_ccm_auth_decrypt(&slot.ccmRx, cipherLen, nonce, AEAD_NONCE_LEN, frame, AEAD_HEADER_LEN,
+                                 cipher, cipher, cipher + cipherLen, AEAD_TAG_LEN) != 0) {
+        return -1;
+    }
+
+    counter = 0;
+    for (int i = 1; i < AEAD_HEADER_LEN; i++) {
+        counter = (counter << 8) | frame[i];
+    }
+    plain = cipher;
+    return cipherLen;
+}
+
+size_t framePayloadCapacity(const PeerCrypto& crypto, size_t frameCapacity) {
+    size_t overhead = crypto.mode == CRYPTO_MODE_PLAINTEXT ? 1 : crypto.mode == CRYPTO_MODE_AEAD ? AEAD_OVERHEAD : 16;
+    return frameCapacity > overhead ? frameCapacity - overhead : 0;
+}
+
+int payloadToFrame(const PeerCrypto& crypto, const uint8_t* payload, size_t length, uint8_t* frame, size_t frameCapacity) {
+    if (crypto.mode == CRYPTO_MODE_PLAINTEXT) {
+        // Plain frames carry a null terminator for the receivers
+        if (length + 1 > frameCapacity) {
+            LOG_ERROR(LOG_SRC_TRANS, "Message too long - %u, max %u bytes allowed", (unsigned)length, (unsigned)(frameCapacity - 1));
             return -1;
         }
-        memcpy(byteArray, charArray, length);
-        byteArray[length] = '\0';
-        return length+1;
+        memcpy(frame, payload, length);
+        frame[length] = '\0';
+        return length + 1;
+    }
+
+    if (!isCryptoKeySet(crypto.keySlot)) {
+        LOG_ERROR(LOG_SRC_TRANS, "Key slot %u is not set", crypto.keySlot);
+        return -1;
+    }
+
+    // Key slots only change from loop(), which is also where frames are encrypted
+    CryptoKey& slot = keys[crypto.keySlot];
+    bool aead = crypto.mode == CRYPTO_MODE_AEAD;
+    size_t overhead = aead ? AEAD_OVERHEAD : 16;
+    int encryptedLen = length + overhead > frameCapacity ? -1 :
+                       aead ? encryptFrameAead(slot, payload, length, frame, frameCapacity)
+                            : encryptFrame(slot, payload, length, frame, frameCapacity);
+    if (encryptedLen == -1) {
+        LOG_ERROR(LOG_SRC_TRANS, "Message too long - %u, max %u bytes allowed when encrypted", (unsigned)length,
+                  (unsigned)(frameCapacity - overhead));
+        return -1;
     }
+    return encryptedLen;
 }
 
-void inPlaceDecryptAndLog(byte* message, int length) {
-    char decryptedText[251];
-    aes_decrypt(message, length, decryptedText);
-    //Serial.print("[TRANS] Decrypted message: ");
-    //Serial.println(decryptedText);
-    length = strlen(decryptedText);
-    logMessageToSerial((byte*)decryptedText, length, false);
-    memcpy(message, decryptedText, length+1); // Copy null-terminator
+// Whether a decrypted payload starts like one the receive path understands
+static bool isKnownPayloadStart(uint8_t first) {
+    return first == '{' || first == FRAGMENT_MARKER || first == PROBE_MARKER || first == BATCH_MARKER ||
+           first == COMPRESSION_HEADER_DICT_V1 || first == COMPRESSION_HEADER_STORED;
 }
 
-void inPlaceDecrypt(byte* message, int length) {
-    char decryptedText[251];
-    aes_decrypt(message, length, decryptedText);
-    length = strlen(decryptedText);
-    memcpy(message, decryptedText, length+1); // Copy null-terminator
-}
\ No newline at end of file
+// Decrypt with the key of the sender; counter is set for authenticated AEAD frames
+static int decryptWithKey(CryptoKey& slot, const PeerCrypto& crypto, const uint8_t* senderMac,
+                          uint8_t* frame, size_t length, uint8_t*& payload, bool& aead, uint64_t& counter) {
+    // Peers still configured for CTR may already send AEAD, AEAD peers may
+    // only fall back to CTR while legacy frames are accepted
+    bool acceptLegacy = crypto.mode == CRYPTO_MODE_CTR || CRYPTO_ACCEPT_LEGACY_CTR;
+
+    if (length >= AEAD_OVERHEAD && frame[0] == AEAD_FRAME_VERSION) {
+        // A failed tag check wipes the plaintext buffer – keep the frame
+        // for the legacy attempt below
+        static uint8_t original[AEAD_MAX_FRAME];  // Receive task only
+        size_t keep = acceptLegacy && length <= sizeof(original) ? length : 0;
+        memcpy(original, frame, keep);
+
+        int plainLen = decryptFrameAead(slot, senderMac, frame, length, payload, counter);
+        if (plainLen >= 0) {
+            aead = true;
+            return plainLen;
+        }
+        if (keep == 0) {
+            return CRYPTO_ERR_AUTH;
+        }
+
+        // 1 in 256 legacy frames starts with the version byte by chance.
+        // CTR peers send legacy frames anyway; from AEAD peers accept them
+        // only if they decrypt to a payload the receiver understands.
+        memcpy(frame, original, keep);
+        plainLen = decryptFrame(slot, frame, length, payload);
+        if (crypto.mode == CRYPTO_MODE_CTR) {
+            return plainLen;
+        }
+        return plainLen > 0 && isKnownPayloadStart(payload[0]) ? plainLen : CRYPTO_ERR_AUTH;
+    }
+    if (!acceptLegacy) {
+        return CRYPTO_ERR_AUTH;
+    }
+    return decryptFrame(slot, frame, length, payload);
+}
+
+int frameToPayload(const uint8_t* senderMac, uint8_t* frame, size_t length, uint8_t*& payload) {
+    PeerCrypto crypto = resolvePeerCrypto(senderMac);
+
+    if (crypto.mode == CRYPTO_MODE_PLAINTEXT) {
+        // Drop the null terminator of plain frames
+        payload = frame;
+        if (length > 0 && frame[length - 1] == '\0') {
+            length--;
+        }
+        return length;
+    }
+
+    // Slot 0 is immutable and used without locking
+    bool locked = crypto.keySlot != 0;
+    if (locked) {
+        xSemaphoreTake(keyMutex, portMAX_DELAY);
+    }
+    bool aead = false;
+    uint64_t counter = 0;
+    int plainLen = !isCryptoKeySet(crypto.keySlot) ? CRYPTO_ERR_AUTH :
+                   decryptWithKey(keys[crypto.keySlot], crypto, senderMac, frame, length, payload, aead, counter);
+    if (locked) {
+        xSemaphoreGive(keyMutex);
+    }
+
+    if (aead && !acceptPeerCounter(senderMac, counter)) {
+        return CRYPTO_ERR_REPLAY;
+    }
+    return plainLen;
+}
@@ -1,32 +1,196 @@
 #include "espnow_handler.h"
 #include "config.h"
 #include "crypto.h"
+#include "compression.h"
+#include "fragmentation.h"
 #include "logger.h"
 #include <ArduinoJson.h>
 #include "led_handler.h"
+#include "peer_directory.h"
 #include <WiFi.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
 #include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>
+#include <atomic>
 
 // Define LED_BUILTIN for ESP32 (not defined by default)
 #ifndef LED_BUILTIN
 #define LED_BUILTIN 2
 #endif
 
-#define MAX_PEERS 20
+#define MAX_GROUPS 8
 #define NVS_NAMESPACE "espnow_gw"
 #define NVS_MAC_KEY "custom_mac"
+#define NVS_GROUPS_KEY "groups"
+
+// Coalescing (batch format in espnow_handler.h)
+static_assert(FRAGMENT_MAX_MESSAGE < 0x8000, "Batch lengths are limited to 15 bits");
+#define COALESCE_BATCH_SLOTS 4      // Peers with a batch pending at the same time
+#define COALESCE_MAX_MESSAGES 8     // Messages per batch
+
+// Transmit queue tuning (can be overridden in config.h)
+#ifndef TX_QUEUE_LENGTH
+#define TX_QUEUE_LENGTH 16
+#endif
+#ifndef TX_MAX_IN_FLIGHT
+#define TX_MAX_IN_FLIGHT 4
+#endif
+
+#define TX_RETRY_SLOTS 8              // Failed frames waiting for their backoff to expire
+#define TX_COMPLETION_TIMEOUT_MS 500  // Give up on a send callback that never arrives
+#define TX_TASK_STACK_SIZE 6144
+#define TX_TASK_PRIORITY 2
+
+#ifndef RX_RING_SLOTS
+#define RX_RING_SLOTS 8
+#endif
+#define RX_TASK_STACK_SIZE 6144
+
+#define LOG_FRAME_HEAD_BYTES 48  // Message bytes shown in the debug line of a sent frame
+
+// How long loop() waits in total for room in the TX queue while queueing the
+// fragments of one message
+#ifndef FRAGMENT_ENQUEUE_WAIT_MS
+#define FRAGMENT_ENQUEUE_WAIT_MS 100
+#endif
+#define RX_TASK_PRIORITY 2
 
 // NVS storage
 static Preferences preferences;
 
-// Peer management
-static uint8_t peerList[MAX_PEERS][6];
-static uint8_t peerCount = 0;
+// Named peer groups usable as "to" target (persisted in NVS)
+struct PeerGroup {
+  char name[ESPNOW_GROUP_NAME_MAX_LEN];  // empty = unused
+  uint8_t count;
+  uint8_t members[ESPNOW_MAX_TARGETS][6];
+};
+
+static PeerGroup peerGroups[MAX_GROUPS];
+
+static const uint8_t BROADCAST_MAC[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// ---------------------------------------------------------------------------
+// Asynchronous transmit path
+//
+// loop() serializes and encrypts a frame and drops it into txQueue. The sender
+// task owns esp_now_send() and keeps up to TX_MAX_IN_FLIGHT frames outstanding.
+// Completions coming back from onEspNowDataSent() are matched against a FIFO
+// of in-flight frames: the oldest frame sent to the reported MAC.
+//
+// A frame the MAC layer reports as failed is parked, still encrypted, in a
+// retry slot and retransmitted after an exponential backoff with jitter until
+// the peer's retry policy is exhausted. Only the final outcome is reported.
+// ---------------------------------------------------------------------------
+
+struct TxFrame {
+  uint8_t mac[6];
+  uint16_t len;
+  int64_t enqueuedUs;       // esp_timer timestamp when loop() queued the frame
+  char id[ESPNOW_ID_MAX_LEN];   // Correlation ID as raw JSON, empty if none
+  RetryPolicy retry;        // Snapshot of the peer's policy at enqueue time
+  uint8_t attempt;          // Transmissions so far
+  int8_t messageSlot;       // messageAcks entry of a fragmented message, -1 = single frame
+  int8_t ackSlot;           // batchAcks entry of a coalesced batch, -1 = use id
+  uint8_t data[ESPNOW_FRAME_MAX];
+};
+
+struct TxCompletion {
+  uint8_t mac[6];
+  esp_now_send_status_t status;
+};
+
+struct InFlightFrame {
+  TxFrame frame;
+  unsigned long sentAtMs;
+};
+
+struct RetrySlot {
+  bool used;
+  unsigned long dueMs;
+  TxFrame frame;
+};
+
+static QueueHandle_t txQueue = NULL;      // loop() -> sender task
+static QueueHandle_t txDoneQueue = NULL;  // send callback -> sender task
+static TaskHandle_t txTaskHandle = NULL;
+
+// Frame being assembled by loop() before it is queued
+static TxFrame txBuildFrame;
+
+// Messages waiting for the coalescing window of their peer – loop() only
+struct PendingBatch {
+  bool used;
+  uint8_t mac[6];
+  unsigned long startMs;
+  uint8_t windowMs;
+  int64_t enqueuedUs;       // Of the first message, for the ack latency
+  uint8_t count;
+  uint16_t len;
+  int8_t ackSlot;
+  uint8_t data[ESPNOW_FRAME_MAX];
+};
+
+// Correlation IDs of the messages in a batch frame. Claimed and written by
+// loop(), read and released by whichever task reports the frame's outcome.
+struct BatchAcks {
+  std::atomic<bool> used;
+  uint8_t count;
+  char ids[COALESCE_MAX_MESSAGES][ESPNOW_ID_MAX_LEN];
+};
 
-// Message buffer for ESP-NOW
-static byte espNowMessageBuffer[251];
+#define BATCH_ACK_SLOTS (TX_QUEUE_LENGTH + TX_MAX_IN_FLIGHT + TX_RETRY_SLOTS + COALESCE_BATCH_SLOTS)
+
+// Outcome of one fragmented message to one target, shared by loop() (which
+// queues the fragments) and the sender task. The first failure is reported
+// and cancels the fragments still waiting; success is reported once the last
+// outstanding fragment was delivered. An entry is held while any of its
+// fragments is queued, in flight or waiting for a retry, or while loop() is
+// still queueing the message to all its targets.
+struct MessageAcks {
+  std::atomic<bool> used;
+  std::atomic<bool> failed;
+  std::atomic<uint8_t> remaining;  // Fragments without a final outcome yet
+};
+
+#define MESSAGE_ACK_SLOTS (TX_QUEUE_LENGTH + TX_MAX_IN_FLIGHT + TX_RETRY_SLOTS + ESPNOW_MAX_TARGETS)
+static_assert(MESSAGE_ACK_SLOTS <= 127, "messageSlot is an int8_t");
+
+static PendingBatch batches[COALESCE_BATCH_SLOTS];
+static MessageAcks messageAcks[MESSAGE_ACK_SLOTS];
+static BatchAcks batchAcks[BATCH_ACK_SLOTS];
+
+// In-flight FIFO – touched only by the sender task
+static InFlightFrame inFlight[TX_MAX_IN_FLIGHT];
+static uint8_t inFlightHead = 0;
+static uint8_t inFlightCount = 0;
+
+// Frames waiting for retransmission – touched only by the sender task
+static RetrySlot retrySlots[TX_RETRY_SLOTS];
+
+// ---------------------------------------------------------------------------
+// Receive path
+//
+// onEspNowDataReceived() runs in the Wi-Fi driver task and only copies the
+// frame into a preallocated single-producer/single-consumer ring. The receive
+// worker decrypts each slot in place and forwards it to the gateway.
+// ---------------------------------------------------------------------------
+
+struct RxSlot {
+  uint8_t mac[6];
+  uint16_t len;
+  int64_t receivedUs;
+  uint8_t data[ESPNOW_FRAME_MAX];
+};
+
+static RxSlot rxRing[RX_RING_SLOTS];
+static std::atomic<uint32_t> rxHead(0);     // advanced by the Wi-Fi task only
+static std::atomic<uint32_t> rxTail(0);     // advanced by the receive worker only
+static std::atomic<uint32_t> rxDropped(0);  // frames lost because the ring was full
+static TaskHandle_t rxTaskHandle = NULL;
 
 // Helper function to convert hex string to byte array
 static void charToByteArray(const char* charArray, uint8_t* byteArray) {
@@ -39,39 +203,453 @@ static void charToByteArray(const char* charArray, uint8_t* byteArray) {
   }
 }
 
-// Helper function to add a peer if not already in the list
-static bool addPeerIfNeeded(const uint8_t* peerAddress) {
-  // Check if peer already exists
-  for (int i = 0; i < peerCount; i++) {
-    if (memcmp(peerList[i], peerAddress, 6) == 0) {
-      return true; // Already exists
+bool parseMacAddress(const char* macString, uint8_t* macAddress) {
+  if (macString == nullptr || strlen(macString) != 12) {
+    return false;
+  }
+  for (int i = 0; i < 12; i++) {
+    if (!isxdigit((unsigned char)macString[i])) {
+      return false;
     }
   }
-  
-  // Check if peer list is full
-  if (peerCount >= MAX_PEERS) {
-    logPrintln("[TRANS] ERROR: Peer list full (max 20 peers)");
+  charToByteArray(macString, macAddress);
+  return true;
+}
+
+static void formatMac(const uint8_t* mac, char* macStr) {
+  sprintf(macStr, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void logDeliveryStatus(const uint8_t* mac, bool success) {
+  if (success) {
+    LOG_PEER_DEBUG(mac, "Last espnow send status: Delivery success");
+  } else {
+    LOG_PEER_ERROR(mac, "Last espnow send status: Delivery fail");
+  }
+}
+
+// Report the final outcome of a message that carried a correlation ID.
+// mac is nullptr when the message failed before a target was resolved;
+// latencyUs < 0 means the message never reached the radio.
+static void sendAck(const uint8_t* mac, const char* id, const char* status, int64_t latencyUs) {
+  if (id == nullptr || id[0] == '\0') {
+    return;
+  }
+
+  JsonDocument ack;
+  ack["type"] = "ack";
+  ack["id"] = serialized(id);
+  if (mac != nullptr) {
+    char macStr[13];
+    formatMac(mac, macStr);
+    ack["mac"] = macStr;
+  }
+  ack["status"] = status;
+  if (latencyUs >= 0) {
+    ack["latency_us"] = latencyUs;
+  }
+  sendGatewayMessage(ack);
+}
+
+// Report the outcome of a frame – for a coalesced batch once per message that
+// carried an ID, after which the batch's ID entry is free again
+static void sendFrameAck(const TxFrame& frame, const char* status, int64_t latencyUs) {
+  if (frame.ackSlot < 0) {
+    sendAck(frame.mac, frame.id, status, latencyUs);
+    return;
+  }
+  BatchAcks& acks = batchAcks[frame.ackSlot];
+  for (int i = 0; i < acks.count; i++) {
+    sendAck(frame.mac, acks.ids[i], status, latencyUs);
+  }
+  acks.used.store(false, std::memory_order_release);
+}
+
+// Claim a free batch ID entry (loop() only), -1 if all are held by live frames
+static int8_t claimBatchAcks() {
+  for (int i = 0; i < BATCH_ACK_SLOTS; i++) {
+    if (!batchAcks[i].used.load(std::memory_order_acquire)) {
+      batchAcks[i].used.store(true);
+      batchAcks[i].count = 0;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Whether the message a fragment belongs to has already failed for its target
+static bool messageFailed(const TxFrame& frame) {
+  return frame.messageSlot >= 0 && messageAcks[frame.messageSlot].failed.load();
+}
+
+// Report the final outcome of a frame; frames > 1 also settles the later
+// fragments of its message that will never be queued. Fragments of a message
+// are reported once per target: the first failure, or success after the last
+// fragment was delivered.
+static void finishFrame(const TxFrame& frame, bool success, const char* status, int64_t latencyUs, uint8_t frames = 1) {
+  if (frame.messageSlot < 0) {
+    sendFrameAck(frame, status, latencyUs);
+    return;
+  }
+  MessageAcks& acks = messageAcks[frame.messageSlot];
+  if (!success && !acks.failed.exchange(true)) {
+    sendFrameAck(frame, status, latencyUs);
+  }
+  if (acks.remaining.fetch_sub(frames) == frames) {
+    if (!acks.failed.load()) {
+      sendFrameAck(frame, "success", latencyUs);
+    }
+    acks.used.store(false, std::memory_order_release);
+  }
+}
+
+// Claim the outcome entry for a message of fragments frames (loop() only), -1 if none is free
+static int8_t claimMessageAcks(uint8_t fragments) {
+  for (int i = 0; i < MESSAGE_ACK_SLOTS; i++) {
+    bool expected = false;
+    if (messageAcks[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+      messageAcks[i].failed.store(false);
+      messageAcks[i].remaining.store(fragments);
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Backoff before retransmission number `attempt` (1-based): exponential growth
+// capped at backoffMaxMs, with "equal jitter" so peers that failed together do
+// not retry in lockstep
+static uint32_t retryDelayMs(const RetryPolicy& policy, uint8_t attempt) {
+  uint32_t delayMs = policy.backoffMs;
+  for (uint8_t i = 1; i < attempt && delayMs < policy.backoffMaxMs; i++) {
+    delayMs *= 2;
+  }
+  if (delayMs > policy.backoffMaxMs) {
+    delayMs = policy.backoffMaxMs;
+  }
+  return delayMs / 2 + esp_random() % (delayMs / 2 + 1);
+}
+
+// Park a failed frame for retransmission. Returns false when the policy is
+// exhausted (or no slot is free) and the failure is final.
+static bool scheduleRetry(const TxFrame& frame) {
+  if (frame.attempt >= frame.retry.maxAttempts) {
+    return false;
+  }
+
+  for (int i = 0; i < TX_RETRY_SLOTS; i++) {
+    if (!retrySlots[i].used) {
+      uint32_t delayMs = retryDelayMs(frame.retry, frame.attempt);
+      retrySlots[i].used = true;
+      retrySlots[i].dueMs = millis() + delayMs;
+      retrySlots[i].frame = frame;
+
+      LOG_PEER_WARN(frame.mac, "No MAC ack, retransmitting (attempt %u of %u) in %u ms",
+                    frame.attempt + 1, frame.retry.maxAttempts, delayMs);
+      return true;
+    }
+  }
+
+  LOG_WARN(LOG_SRC_TRANS, "Retry slots exhausted, not retransmitting");
+  return false;
+}
+
+// Ticks until the earliest retry is due (portMAX_DELAY if none)
+static TickType_t nextRetryWait() {
+  TickType_t wait = portMAX_DELAY;
+  unsigned long now = millis();
+  for (int i = 0; i < TX_RETRY_SLOTS; i++) {
+    if (retrySlots[i].used) {
+      long remaining = (long)(retrySlots[i].dueMs - now);
+      TickType_t ticks = remaining > 0 ? pdMS_TO_TICKS(remaining) : 0;
+      if (ticks < wait) {
+        wait = ticks;
+      }
+    }
+  }
+  return wait;
+}
+
+// Pop the oldest in-flight frame
+static InFlightFrame& popInFlight() {
+  InFlightFrame& oldest = inFlight[inFlightHead];
+  inFlightHead = (inFlightHead + 1) % TX_MAX_IN_FLIGHT;
+  inFlightCount--;
+  return oldest;
+}
+
+// Take the oldest in-flight frame sent to mac out of the FIFO, nullptr if there is none
+static InFlightFrame* takeInFlight(const uint8_t* mac) {
+  static InFlightFrame taken;
+  for (uint8_t i = 0; i < inFlightCount; i++) {
+    if (memcmp(inFlight[(inFlightHead + i) % TX_MAX_IN_FLIGHT].frame.mac, mac, 6) != 0) {
+      continue;
+    }
+    if (i == 0) {
+      return &popInFlight();
+    }
+    // Close the gap so the younger frames keep their order
+    taken = inFlight[(inFlightHead + i) % TX_MAX_IN_FLIGHT];
+    for (uint8_t j = i; j + 1 < inFlightCount; j++) {
+      inFlight[(inFlightHead + j) % TX_MAX_IN_FLIGHT] = inFlight[(inFlightHead + j + 1) % TX_MAX_IN_FLIGHT];
+    }
+    inFlightCount--;
+    return &taken;
+  }
+  return nullptr;
+}
+
+// Retire the oldest in-flight frame to the reported peer with its status
+static void completeInFlight(const TxCompletion& done) {
+  int64_t now = esp_timer_get_time();
+  bool success = done.status == ESP_NOW_SEND_SUCCESS;
+
+  InFlightFrame* match = takeInFlight(done.mac);
+  if (match == nullptr) {
+    // Late callback for a frame we already timed out – nothing to match
+    if (inFlightCount > 0) {
+      LOG_PEER_WARN(done.mac, "Send completion for no in-flight frame");
+    }
+    logDeliveryStatus(done.mac, success);
+    return;
+  }
+  InFlightFrame& oldest = *match;
+
+  // A fragment of a message that already failed is not worth retrying
+  if (!success && !messageFailed(oldest.frame) && scheduleRetry(oldest.frame)) {
+    return;
+  }
+
+  logDeliveryStatus(done.mac, success);
+  finishFrame(oldest.frame, success, success ? "success" : "fail", now - oldest.frame.enqueuedUs);
+}
+
+// Drop in-flight frames whose send callback never arrived (e.g. ESP-NOW was
+// torn down by a switch to Wi-Fi mode) so the window cannot stall forever
+static void expireInFlight() {
+  unsigned long now = millis();
+  while (inFlightCount > 0 && now - inFlight[inFlightHead].sentAtMs >= TX_COMPLETION_TIMEOUT_MS) {
+    InFlightFrame& expired = popInFlight();
+    logDeliveryStatus(expired.frame.mac, false);
+    finishFrame(expired.frame, false, "timeout", esp_timer_get_time() - expired.frame.enqueuedUs);
+  }
+}
+
+static void transmitFrame(const TxFrame& frame) {
+  // Remaining fragments of a failed message are cancelled
+  if (messageFailed(frame)) {
+    finishFrame(frame, false, "fail", -1);
+    return;
+  }
+
+  // Reserve the in-flight slot first: the send callback may fire before
+  // esp_now_send() even returns
+  InFlightFrame& slot = inFlight[(inFlightHead + inFlightCount) % TX_MAX_IN_FLIGHT];
+  slot.frame = frame;
+  slot.frame.attempt++;
+  slot.sentAtMs = millis();
+  inFlightCount++;
+
+  // Claim a driver slot for the peer (may evict the least recently used one)
+  if (!ensurePeerRegistered(frame.mac)) {
+    inFlightCount--;
+    finishFrame(frame, false, "error", -1);
+    return;
+  }
+
+  esp_err_t sendResult = esp_now_send(frame.mac, frame.data, frame.len);
+  if (sendResult != ESP_OK) {
+    inFlightCount--;
+    LOG_ERROR(LOG_SRC_TRANS, "esp_now_send failed with code: %d", sendResult);
+    finishFrame(frame, false, "error", -1);
+  } else {
+    triggerLedFlash();
+  }
+}
+
+// Retransmit due frames before taking new ones from the queue
+static void sendDueRetries() {
+  unsigned long now = millis();
+  for (int i = 0; i < TX_RETRY_SLOTS && inFlightCount < TX_MAX_IN_FLIGHT; i++) {
+    if (retrySlots[i].used && (long)(now - retrySlots[i].dueMs) >= 0) {
+      retrySlots[i].used = false;
+      transmitFrame(retrySlots[i].frame);
+    }
+  }
+}
+
+static void txTask(void* parameter) {
+  static TxFrame frame;
+  for (;;) {
+    // Sleep until a frame is queued, a completion arrives or a retry is due;
+    // while frames are outstanding wake up periodically to expire lost callbacks
+    // (a due retry only matters once the in-flight window has room again)
+    TickType_t wait = inFlightCount < TX_MAX_IN_FLIGHT ? nextRetryWait() : portMAX_DELAY;
+    if (inFlightCount > 0 && wait > pdMS_TO_TICKS(TX_COMPLETION_TIMEOUT_MS)) {
+      wait = pdMS_TO_TICKS(TX_COMPLETION_TIMEOUT_MS);
+    }
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    TxCompletion done;
+    while (xQueueReceive(txDoneQueue, &done, 0) == pdTRUE) {
+      completeInFlight(done);
+    }
+    expireInFlight();
+    sendDueRetries();
+
+    while (inFlightCount < TX_MAX_IN_FLIGHT && xQueueReceive(txQueue, &frame, 0) == pdTRUE) {
+      frame.attempt = 0;
+      transmitFrame(frame);
+    }
+  }
+}
+
+// Create the TX queues and sender task (only once – survives mode switches)
+static bool startTxTask() {
+  if (txTaskHandle != NULL) {
+    return true;
+  }
+
+  txQueue = xQueueCreate(TX_QUEUE_LENGTH, sizeof(TxFrame));
+  txDoneQueue = xQueueCreate(TX_MAX_IN_FLIGHT * 2, sizeof(TxCompletion));
+  if (txQueue == NULL || txDoneQueue == NULL) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to allocate TX queues");
     return false;
   }
+
+  if (xTaskCreate(txTask, "espnow_tx", TX_TASK_STACK_SIZE, NULL, TX_TASK_PRIORITY, &txTaskHandle) != pdPASS) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to start ESP-NOW sender task");
+    txTaskHandle = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void processRxSlot(RxSlot& slot) {
+  triggerLedFlash();
+
+  char macStr[13];
+  formatMac(slot.mac, macStr);
   
-  // Add new peer (ESP32 API)
-  esp_now_peer_info_t peerInfo = {};
-  memcpy(peerInfo.peer_addr, peerAddress, 6);
-  peerInfo.channel = 0;  // Use current channel
-  peerInfo.encrypt = false;
+  LOG_PEER_DEBUG(slot.mac, "From esp-now received %d bytes (queued %lu us)", slot.len,
+                 (unsigned long)(esp_timer_get_time() - slot.receivedUs));
   
-  esp_err_t addPeerResult = esp_now_add_peer(&peerInfo);
-  if (addPeerResult != ESP_OK) {
-    logPrint("[TRANS] ERROR: Failed to add peer, code: ");
-    logPrintln(addPeerResult);
-    return false;
+  uint8_t* frame;
+  int payloadLen = frameToPayload(slot.mac, slot.data, slot.len, frame);
+  if (payloadLen <= 0) {
+    const char* reason = payloadLen == CRYPTO_ERR_AUTH ? "unauthenticated" :
+                         payloadLen == CRYPTO_ERR_REPLAY ? "replayed" : "malformed";
+    LOG_PEER_ERROR(slot.mac, "Dropping %s frame of %d bytes", reason, slot.len);
+    return;
+  }
+  
+  // Anything beyond the v1 limit proves the peer sends v2 frames
+  if (slot.len > ESPNOW_V1_FRAME_MAX && getPeerFrameMax(slot.mac) == ESPNOW_V1_FRAME_MAX) {
+    setPeerFrameMax(slot.mac, ESPNOW_FRAME_MAX);
+    LOG_PEER_INFO(slot.mac, "Peer sends ESP-NOW v2 frames, using frames up to %d bytes", ESPNOW_FRAME_MAX);
+  }
+  
+  // Answer to probeEspNowPeer() – consumed here, not forwarded
+  if (payloadLen >= 4 && frame[0] == PROBE_MARKER && frame[1] == PROBE_REPLY) {
+    uint16_t peerMax = (frame[2] << 8) | frame[3];
+    uint16_t frameMax = peerMax < ESPNOW_FRAME_MAX ? peerMax : ESPNOW_FRAME_MAX;
+    setPeerFrameMax(slot.mac, frameMax);
+    LOG_PEER_INFO(slot.mac, "Frame size probe answered, using frames up to %u bytes", frameMax);
+    
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "probe-peer";
+    resp["status"] = "success";
+    resp["mac"] = macStr;
+    resp["frame_max"] = frameMax;
+    sendGatewayMessage(resp);
+    return;
+  }
+  
+  // Collect fragments until the message is complete
+  const uint8_t* payload = frame;
+  if (payload[0] == FRAGMENT_MARKER) {
+    payloadLen = reassembleFragment(slot.mac, frame, payloadLen, payload);
+    if (payloadLen < 0) {
+      LOG_PEER_ERROR(slot.mac, "Dropping malformed fragment");
+    }
+    if (payloadLen <= 0) {
+      return;
+    }
+    LOG_PEER_INFO(slot.mac, "Reassembled %d byte message", payloadLen);
   }
   
-  // Track in our list
-  memcpy(peerList[peerCount], peerAddress, 6);
-  peerCount++;
+  // Expand compressed payloads of peers that opted in (RX task only)
+  static uint8_t decoded[FRAGMENT_MAX_MESSAGE];
+  if (getPeerCompression(slot.mac)) {
+    payloadLen = decodePayload(payload, payloadLen, decoded, sizeof(decoded));
+    if (payloadLen <= 0) {
+      LOG_PEER_ERROR(slot.mac, "Dropping frame with malformed compressed payload");
+      return;
+    }
+  }
   
-  logPrintln("[TRANS] New peer added");
+  // Forward data message to gateway, one per message of a coalesced batch
+  if (payload[0] != BATCH_MARKER) {
+    sendGatewayData(slot.mac, (const char*)payload, payloadLen);
+    return;
+  }
+  size_t offset = 1;
+  while (offset < (size_t)payloadLen) {
+    size_t length = payload[offset++];
+    if ((length & 0x80) && offset < (size_t)payloadLen) {
+      length = ((length & 0x7F) << 8) | payload[offset++];
+    }
+    if (length == 0 || offset + length > (size_t)payloadLen) {
+      LOG_PEER_ERROR(slot.mac, "Dropping rest of malformed batch");
+      return;
+    }
+    sendGatewayData(slot.mac, (const char*)payload + offset, length);
+    offset += length;
+  }
+}
+
+static void rxTask(void* parameter) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    uint32_t tail = rxTail.load(std::memory_order_relaxed);
+    while (tail != rxHead.load(std::memory_order_acquire)) {
+      processRxSlot(rxRing[tail % RX_RING_SLOTS]);
+      tail++;
+      rxTail.store(tail, std::memory_order_release);
+    }
+
+    uint32_t dropped = rxDropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      LOG_WARN(LOG_SRC_TRANS, "RX ring full, dropped %u frames", dropped);
+    }
+  }
+}
+
+static bool startRxTask() {
+  if (rxTaskHandle != NULL) {
+    return true;
+  }
+
+  if (xTaskCreate(rxTask, "espnow_rx", RX_TASK_STACK_SIZE, NULL, RX_TASK_PRIORITY, &rxTaskHandle) != pdPASS) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to start ESP-NOW receive task");
+    rxTaskHandle = NULL;
+    return false;
+  }
+  return true;
+}
+
+// Hand a prepared frame to the sender task, waiting at most `wait` for room in the queue
+// Queue a frame for the sender task; unsent counts it and any later fragments
+// of its message that will not be queued when it is dropped
+static bool enqueueFrame(const TxFrame& frame, TickType_t wait, uint8_t unsent = 1) {
+  if (xQueueSend(txQueue, &frame, wait) != pdTRUE) {
+    LOG_ERROR(LOG_SRC_TRANS, "TX queue full, message dropped");
+    finishFrame(frame, false, "dropped", -1, unsent);
+    return false;
+  }
+  xTaskNotifyGive(txTaskHandle);
   return true;
 }
 
@@ -81,39 +659,54 @@ bool setupEspNow() {
   
   // Ensure WiFi is in STA mode (may have been set by loadCustomMacAddress)
   if (WiFi.getMode() != WIFI_STA) {
-    logPrintln("[TRANS] Setting WiFi mode to STA...");
+    LOG_INFO(LOG_SRC_TRANS, "Setting WiFi mode to STA...");
     WiFi.mode(WIFI_STA);
     delay(100);
   }
 
   // Init ESP-NOW with retry logic (ESP32 API)
-  logPrintln("[TRANS] Initializing ESP-NOW...");
+  LOG_INFO(LOG_SRC_TRANS, "Initializing ESP-NOW...");
   esp_err_t espNowInitResult = esp_now_init();
   
   if (espNowInitResult != ESP_OK) {
-    logPrint("[TRANS] ERROR: ESP-NOW initialization failed with code: ");
-    logPrintln(espNowInitResult);
-    logPrint("[TRANS] Will wait ");
-    logPrint(INIT_RETRY_TIMEOUT_MS / 1000);
-    logPrintln(" seconds and then reboot...");
+    LOG_ERROR(LOG_SRC_TRANS, "ESP-NOW initialization failed with code: %d", espNowInitResult);
+    LOG_INFO(LOG_SRC_TRANS, "Will wait %d seconds and then reboot...", INIT_RETRY_TIMEOUT_MS / 1000);
+    initSuccess = false;
+  }
+  
+  // The callbacks hand frames to these tasks, so they have to exist first
+  if (initSuccess && (!startTxTask() || !startRxTask())) {
     initSuccess = false;
   }
   
   if (initSuccess) {
     // Register callbacks (ESP32 API)
     if (esp_now_register_send_cb(onEspNowDataSent) != ESP_OK) {
-      logPrintln("[TRANS] ERROR: Failed to register send callback");
+      LOG_ERROR(LOG_SRC_TRANS, "Failed to register send callback");
       initSuccess = false;
     }
   }
   
   if (initSuccess) {
     if (esp_now_register_recv_cb(onEspNowDataReceived) != ESP_OK) {
-      logPrintln("[TRANS] ERROR: Failed to register receive callback");
+      LOG_ERROR(LOG_SRC_TRANS, "Failed to register receive callback");
       initSuccess = false;
     }
   }
   
+  // Frames are sent from the station interface; its MAC is part of the AEAD nonce
+  uint8_t localMac[6];
+  WiFi.macAddress(localMac);
+  setCryptoLocalMac(localMac);
+  
+  // The driver peer table starts out empty after esp_now_init()
+  resetPeerRegistrations();
+  
+  // Warm-load known peers so the first command to each one skips esp_now_add_peer()
+  if (initSuccess) {
+    registerKnownPeers();
+  }
+  
   if (!initSuccess) {
     // Blink LED rapidly to indicate error
     pinMode(LED_BUILTIN, OUTPUT);
@@ -124,104 +717,555 @@ bool setupEspNow() {
       delay(100);
     }
     
-    logPrintln("[TRANS] Rebooting now...");
-    Serial.flush();
+    LOG_INFO(LOG_SRC_TRANS, "Rebooting now...");
+    flushLogs();
     delay(100);
     ESP.restart();
   }
   
-  logPrintln("[TRANS] ESP-NOW transmitter started successfully!");
-  logPrint("[TRANS] MAC Address: ");
-  logPrintln(WiFi.macAddress());
+  LOG_INFO(LOG_SRC_TRANS, "ESP-NOW transmitter started successfully!");
+  LOG_INFO(LOG_SRC_TRANS, "MAC Address: %s", WiFi.macAddress());
+  
+  uint32_t espNowVersion = 0;
+  esp_now_get_version(&espNowVersion);
+  LOG_INFO(LOG_SRC_TRANS, "ESP-NOW version %u, frames up to %d bytes", espNowVersion, ESPNOW_FRAME_MAX);
   
   return true;
 }
 
-void sendEspNowMessage(const char* macAddress, JsonObject messageObj) {
-  uint8_t peerAddress[6];
-  charToByteArray(macAddress, peerAddress);
+// Compress, fragment and encrypt a payload for targets that share encryption,
+// compression, frame size and support of the framed formats, and queue the
+// frames for the sender task
+static void queuePayload(const uint8_t (*macs)[6], const RetryPolicy* retries, int count,
+                         const PeerCrypto& crypto, bool compress, uint16_t frameMax, bool framedPeers,
+                         const uint8_t* payload, size_t length,
+                         const char* id, int8_t ackSlot, int64_t enqueuedUs) {
+  static uint8_t compressed[FRAGMENT_MAX_MESSAGE];
+  static uint8_t fragment[ESPNOW_FRAME_MAX];
+  
+  txBuildFrame.enqueuedUs = enqueuedUs;
+  strlcpy(txBuildFrame.id, id != nullptr ? id : "", sizeof(txBuildFrame.id));
+  txBuildFrame.ackSlot = ackSlot;
+  
+  const uint8_t* framePayload = payload;
+  size_t framePayloadLength = length;
+  int compressedLength = 0;
+  if (compress) {
+    compressedLength = encodePayload(payload, length, compressed, sizeof(compressed));
+    if (compressedLength > 0) {
+      if (compressed[0] == COMPRESSION_HEADER_DICT_V1) {
+        LOG_INFO(LOG_SRC_TRANS, "Compressed payload from %u to %d bytes", (unsigned)length, compressedLength);
+      }
+      framePayload = compressed;
+      framePayloadLength = compressedLength;
+    }
+  }
+  
+  // Split payloads that do not fit into one frame (v2 peers take larger frames).
+  // To peers that parse the framed formats, a payload starting with a fragment
+  // or probe marker goes out as a message of one fragment, so the receiver
+  // does not take it for one.
+  size_t capacity = framePayloadCapacity(crypto, frameMax);
+  size_t chunkSize = capacity - FRAGMENT_HEADER_LEN;
+  bool reserved = framedPeers && framePayloadLength > 0 && (framePayload[0] == FRAGMENT_MARKER || framePayload[0] == PROBE_MARKER);
+  int fragments = framePayloadLength <= capacity && !reserved ? 1 : fragmentCount(framePayloadLength, chunkSize);
+  bool framed = fragments > 1 || reserved;
+  if (fragments == 0 || compressedLength < 0) {
+    LOG_ERROR(LOG_SRC_TRANS, "Message too long - %u bytes, max %d bytes allowed", (unsigned)length, FRAGMENT_MAX_MESSAGE);
+    for (int i = 0; i < count; i++) {
+      memcpy(txBuildFrame.mac, macs[i], 6);
+      sendFrameAck(txBuildFrame, "error", -1);
+    }
+    return;
+  }
+  uint16_t messageId = 0;
+  if (framed) {
+    messageId = nextFragmentMessageId();
+  }
+  if (fragments > 1) {
+    LOG_INFO(LOG_SRC_TRANS, "Splitting %u byte payload into %d fragments", (unsigned)framePayloadLength, fragments);
+  }
+  
+  // A target is given up on its first fragment that cannot be queued or
+  // fails; the outcome of its fragments is reported once (see MessageAcks)
+  static bool targetFailed[ESPNOW_MAX_TARGETS];
+  static int8_t targetAcks[ESPNOW_MAX_TARGETS];
+  int remaining = count;
+  for (int i = 0; i < count; i++) {
+    targetFailed[i] = false;
+    targetAcks[i] = fragments > 1 ? claimMessageAcks(fragments) : -1;
+    if (fragments > 1 && targetAcks[i] < 0) {
+      LOG_PEER_ERROR(macs[i], "No free fragment ack slot, message dropped");
+      memcpy(txBuildFrame.mac, macs[i], 6);
+      txBuildFrame.messageSlot = -1;
+      sendFrameAck(txBuildFrame, "dropped", -1);
+      targetFailed[i] = true;
+      remaining--;
+    }
+  }
+  TickType_t waitStart = xTaskGetTickCount();
+  TickType_t waitBudget = pdMS_TO_TICKS(FRAGMENT_ENQUEUE_WAIT_MS);
+  
+  for (int f = 0; f < fragments && remaining > 0; f++) {
+    int frameLength;
+    if (framed) {
+      size_t fragmentLength = buildFragment(framePayload, framePayloadLength, chunkSize, messageId, f, fragments, fragment);
+      frameLength = payloadToFrame(crypto, fragment, fragmentLength, txBuildFrame.data, frameMax);
+    } else {
+      frameLength = payloadToFrame(crypto, framePayload, framePayloadLength, txBuildFrame.data, frameMax);
+    }
+    if (frameLength > 0) {
+      txBuildFrame.len = frameLength;
+      // The start of the message, never the frame bytes – no UART time on the send path
+      LOG_DEBUG(LOG_SRC_TRANS, "Sending %d byte frame: %s", frameLength,
+                LogSpan{(const char*)payload, length < LOG_FRAME_HEAD_BYTES ? length : LOG_FRAME_HEAD_BYTES});
+    }
+    for (int i = 0; i < count; i++) {
+      if (targetFailed[i]) {
+        continue;
+      }
+      memcpy(txBuildFrame.mac, macs[i], 6);
+      txBuildFrame.messageSlot = targetAcks[i];
+      if (frameLength <= 0) {
+        finishFrame(txBuildFrame, false, "error", -1, fragments - f);
+        continue;
+      }
+      if (messageFailed(txBuildFrame)) {
+        // An earlier fragment already failed in the sender task
+        finishFrame(txBuildFrame, false, "fail", -1, fragments - f);
+        targetFailed[i] = true;
+        remaining--;
+        continue;
+      }
+      
+      txBuildFrame.retry = retries[i];
+      if (memcmp(macs[i], BROADCAST_MAC, 6) == 0) {
+        // Broadcasts are never acknowledged at the MAC layer – nothing to retry
+        txBuildFrame.retry.maxAttempts = 1;
+      }
+      // Fragments wait for room in the queue, a partial message is useless
+      TickType_t wait = 0;
+      if (fragments > 1) {
+        TickType_t waited = xTaskGetTickCount() - waitStart;
+        wait = waited < waitBudget ? waitBudget - waited : 0;
+      }
+      if (!enqueueFrame(txBuildFrame, wait, fragments - f)) {
+        targetFailed[i] = true;
+        remaining--;
+      }
+    }
+    if (frameLength <= 0) {
+      break;
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Coalescing – messages to a peer with a coalescing window are collected in a
+// batch payload and sent as one frame when the batch is full or the window
+// has passed. Batches are built and flushed from loop() only.
+// ---------------------------------------------------------------------------
+
+static void flushBatch(PendingBatch& batch) {
+  if (!batch.used) {
+    return;
+  }
+  batch.used = false;
   
-  // Add peer if needed
-  if (!addPeerIfNeeded(peerAddress)) {
+  // A single message goes out as-is, without the batch header, unless it
+  // starts with the batch marker itself
+  const uint8_t* payload = batch.data;
+  size_t length = batch.len;
+  size_t single = batch.data[1] & 0x80 ? 3 : 2;
+  if (batch.count == 1 && batch.data[single] != BATCH_MARKER) {
+    payload += single;
+    length -= single;
+  } else {
+    LOG_INFO(LOG_SRC_TRANS, "Sending %u coalesced messages in one %u byte batch", batch.count, batch.len);
+  }
+  
+  RetryPolicy retry;
+  if (!addPeer(batch.mac, &retry)) {
+    memcpy(txBuildFrame.mac, batch.mac, 6);
+    txBuildFrame.ackSlot = batch.ackSlot;
+    sendFrameAck(txBuildFrame, "error", -1);
     return;
   }
+  // Peers with a coalescing window parse the framed formats
+  queuePayload(&batch.mac, &retry, 1, resolvePeerCrypto(batch.mac), getPeerCompression(batch.mac),
+               getPeerFrameMax(batch.mac), true, payload, length, nullptr, batch.ackSlot, batch.enqueuedUs);
+}
+
+// Add a message to the peer's batch. Returns false if it has to be sent on
+// its own (any pending batch for the peer is flushed first to keep the order).
+static bool coalesceMessage(const uint8_t* mac, uint8_t windowMs, const uint8_t* payload, size_t length,
+                            const char* id, int64_t enqueuedUs) {
+  PendingBatch* batch = nullptr;
+  PendingBatch* oldest = &batches[0];
+  for (int i = 0; i < COALESCE_BATCH_SLOTS; i++) {
+    if (batches[i].used && memcmp(batches[i].mac, mac, 6) == 0) {
+      batch = &batches[i];
+      break;
+    }
+    if (!batches[i].used || (oldest->used && (long)(batches[i].startMs - oldest->startMs) < 0)) {
+      oldest = &batches[i];
+    }
+  }
   
-  // Convert message object to string
-  String dataStr;
-  serializeJson(messageObj, dataStr);
+  size_t capacity = framePayloadCapacity(resolvePeerCrypto(mac), getPeerFrameMax(mac));
+  size_t entryLength = (length < 0x80 ? 1 : 2) + length;
+  bool hasId = id != nullptr && id[0] != '\0';
   
-  if (dataStr.length() == 0) {
-    logPrintln("[TRANS] ERROR: Empty message");
+  if (batch != nullptr && (batch->len + entryLength > capacity || batch->count >= COALESCE_MAX_MESSAGES)) {
+    flushBatch(*batch);
+    oldest = batch;
+    batch = nullptr;
+  }
+  if (1 + entryLength > capacity) {
+    if (batch != nullptr) {
+      flushBatch(*batch);
+    }
+    return false;
+  }
+  
+  if (batch == nullptr) {
+    // Without a free ID entry the message goes out on its own
+    int8_t ackSlot = claimBatchAcks();
+    if (ackSlot < 0) {
+      LOG_WARN(LOG_SRC_TRANS, "All batch ack slots in use, sending message uncoalesced");
+      return false;
+    }
+    
+    // Take a free slot or send the oldest batch early
+    batch = oldest;
+    flushBatch(*batch);
+    batch->used = true;
+    memcpy(batch->mac, mac, 6);
+    batch->startMs = millis();
+    batch->windowMs = windowMs;
+    batch->enqueuedUs = enqueuedUs;
+    batch->count = 0;
+    batch->data[0] = BATCH_MARKER;
+    batch->len = 1;
+    batch->ackSlot = ackSlot;
+  }
+  
+  uint8_t* out = batch->data + batch->len;
+  if (length < 0x80) {
+    *out++ = length;
+  } else {
+    *out++ = 0x80 | (length >> 8);
+    *out++ = length & 0xFF;
+  }
+  memcpy(out, payload, length);
+  batch->len += entryLength;
+  batch->count++;
+  
+  BatchAcks& acks = batchAcks[batch->ackSlot];
+  if (hasId) {
+    strlcpy(acks.ids[acks.count++], id, ESPNOW_ID_MAX_LEN);
+  }
+  return true;
+}
+
+void handleEspNowBatches() {
+  unsigned long now = millis();
+  for (int i = 0; i < COALESCE_BATCH_SLOTS; i++) {
+    if (batches[i].used && now - batches[i].startMs >= batches[i].windowMs) {
+      flushBatch(batches[i]);
+    }
+  }
+}
+
+void sendEspNowMessage(const uint8_t (*targets)[6], int targetCount, const char* payload, size_t length, const char* id) {
+  // Latency is measured from the moment the command is accepted for sending
+  int64_t enqueuedUs = esp_timer_get_time();
+  
+  if (length == 0) {
+    LOG_ERROR(LOG_SRC_TRANS, "Empty message");
+    sendAck(nullptr, id, "error", -1);
     return;
   }
   
-  // Prepare data for sending
-  uint8_t dataBytes[250];
-  int length = messageToByteArray(dataStr.c_str(), dataBytes, ENABLE_ENCRYPTION);
+  // Peers can use different modes, keys and compression – encrypt once per
+  // distinct combination, then queue a copy of the frame per target using it
+  static PeerCrypto targetCrypto[ESPNOW_MAX_TARGETS];
+  static bool targetCompress[ESPNOW_MAX_TARGETS];
+  static uint16_t targetFrameMax[ESPNOW_MAX_TARGETS];
+  static bool targetFramed[ESPNOW_MAX_TARGETS];
+  static RetryPolicy targetRetry[ESPNOW_MAX_TARGETS];
+  static bool targetDone[ESPNOW_MAX_TARGETS];
+  if (targetCount > ESPNOW_MAX_TARGETS) {
+    targetCount = ESPNOW_MAX_TARGETS;
+  }
+  for (int i = 0; i < targetCount; i++) {
+    // Add peer to the directory if needed; the driver slot is claimed by the sender task
+    targetDone[i] = !addPeer(targets[i], &targetRetry[i]);
+    if (targetDone[i]) {
+      sendAck(targets[i], id, "error", -1);
+      continue;
+    }
+    
+    bool broadcast = memcmp(targets[i], BROADCAST_MAC, 6) == 0;
+    uint8_t windowMs = broadcast ? 0 : getPeerCoalescing(targets[i]);
+    if (windowMs > 0 && coalesceMessage(targets[i], windowMs, (const uint8_t*)payload, length, id, enqueuedUs)) {
+      targetDone[i] = true;
+      continue;
+    }
+    
+    targetCrypto[i] = resolvePeerCrypto(targets[i]);
+    targetCompress[i] = getPeerCompression(targets[i]);
+    // Broadcasts must reach v1 peers as well
+    targetFrameMax[i] = broadcast ? ESPNOW_V1_FRAME_MAX : getPeerFrameMax(targets[i]);
+    targetFramed[i] = !broadcast && getPeerFramedFormats(targets[i]);
+  }
+  
+  // To peers that parse the framed formats, a message starting with the batch
+  // marker goes out as a batch of one, so the receiver does not split it
+  static uint8_t wrapped[FRAGMENT_MAX_MESSAGE + 3];
+  size_t wrappedLength = 0;
+  if ((uint8_t)payload[0] == BATCH_MARKER && length <= FRAGMENT_MAX_MESSAGE) {
+    size_t header = length < 0x80 ? 2 : 3;
+    wrapped[0] = BATCH_MARKER;
+    if (length < 0x80) {
+      wrapped[1] = length;
+    } else {
+      wrapped[1] = 0x80 | (length >> 8);
+      wrapped[2] = length & 0xFF;
+    }
+    memcpy(wrapped + header, payload, length);
+    wrappedLength = length + header;
+  }
+  
+  static uint8_t groupMacs[ESPNOW_MAX_TARGETS][6];
+  static RetryPolicy groupRetry[ESPNOW_MAX_TARGETS];
   
-  if (length > 0) {
-    logPrint("[TRANS] Sending ");
-    logMessageToSerial(dataBytes, length, ENABLE_ENCRYPTION);
+  for (int first = 0; first < targetCount; first++) {
+    if (targetDone[first]) {
+      continue;
+    }
+    const PeerCrypto crypto = targetCrypto[first];
+    const bool compress = targetCompress[first];
+    const uint16_t frameMax = targetFrameMax[first];
+    const bool framed = targetFramed[first];
+    
+    // Targets sharing this combination
+    int groupCount = 0;
+    for (int i = first; i < targetCount; i++) {
+      if (!targetDone[i] && targetCrypto[i].mode == crypto.mode && targetCrypto[i].keySlot == crypto.keySlot &&
+          targetCompress[i] == compress && targetFrameMax[i] == frameMax && targetFramed[i] == framed) {
+        targetDone[i] = true;
+        memcpy(groupMacs[groupCount], targets[i], 6);
+        groupRetry[groupCount] = targetRetry[i];
+        groupCount++;
+      }
+    }
     
-    esp_err_t sendResult = esp_now_send(peerAddress, dataBytes, length);
-    if (sendResult != ESP_OK) {
-      logPrint("[TRANS] ERROR: esp_now_send failed with code: ");
-      logPrintln(sendResult);
+    if (framed && wrappedLength > 0) {
+      queuePayload(groupMacs, groupRetry, groupCount, crypto, compress, frameMax, framed,
+                   wrapped, wrappedLength, id, -1, enqueuedUs);
     } else {
-      triggerLedFlash();
+      queuePayload(groupMacs, groupRetry, groupCount, crypto, compress, frameMax, framed,
+                   (const uint8_t*)payload, length, id, -1, enqueuedUs);
     }
   }
 }
 
-uint8_t getEspNowPeerCount() {
-  return peerCount;
+bool probeEspNowPeer(const uint8_t* mac) {
+#ifdef ESP_NOW_MAX_DATA_LEN_V2
+  static uint8_t probe[ESPNOW_V1_FRAME_MAX];
+  memset(probe, 0, sizeof(probe));
+  probe[0] = PROBE_MARKER;
+  probe[1] = PROBE_REQUEST;
+  probe[2] = ESPNOW_FRAME_MAX >> 8;
+  probe[3] = ESPNOW_FRAME_MAX & 0xFF;
+  
+  int frameLength = payloadToFrame(resolvePeerCrypto(mac), probe, sizeof(probe), txBuildFrame.data, ESPNOW_FRAME_MAX);
+  if (frameLength <= 0 || !addPeer(mac, &txBuildFrame.retry)) {
+    return false;
+  }
+  txBuildFrame.len = frameLength;
+  memcpy(txBuildFrame.mac, mac, 6);
+  txBuildFrame.enqueuedUs = esp_timer_get_time();
+  txBuildFrame.id[0] = '\0';
+  txBuildFrame.ackSlot = -1;
+  txBuildFrame.messageSlot = -1;
+  txBuildFrame.retry.maxAttempts = 1;
+  return enqueueFrame(txBuildFrame, 0);
+#else
+  return false;
+#endif
 }
 
-// Callback when data is sent (ESP32 signature)
-void onEspNowDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
-  char macStr[13];
-  sprintf(macStr, "%02X%02X%02X%02X%02X%02X", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-  if (status == ESP_NOW_SEND_SUCCESS) {
-    logPrintf("[PEER:%s] Last espnow send status: Delivery success\n", macStr);
-  } else {
-    logPrintf("[PEER:%s] ERROR: Last espnow send status: Delivery fail\n", macStr);
+void sendEspNowDryRunAck(const char* id) {
+  sendAck(nullptr, id, "dry_run", -1);
+}
+
+static PeerGroup* findGroup(const char* name) {
+  for (int i = 0; i < MAX_GROUPS; i++) {
+    if (peerGroups[i].name[0] != '\0' && strcmp(peerGroups[i].name, name) == 0) {
+      return &peerGroups[i];
+    }
   }
+  return nullptr;
 }
 
-// Callback when data is received (ESP32 Arduino 2.x/3.x signature)
-void onEspNowDataReceived(const uint8_t *mac, const uint8_t *data, int len) {
-  triggerLedFlash();
-  memcpy(espNowMessageBuffer, data, len);
+int getPeerGroupMembers(const char* name, uint8_t (*targets)[6]) {
+  PeerGroup* group = findGroup(name);
+  if (group == nullptr) {
+    return -1;
+  }
+  memcpy(targets, group->members, group->count * 6);
+  return group->count;
+}
+
+int resolveEspNowTargets(JsonVariantConst to, uint8_t (*targets)[6]) {
+  if (to.is<const char*>()) {
+    const char* name = to;
+    // A single MAC (including FFFFFFFFFFFF for broadcast) ...
+    if (parseMacAddress(name, targets[0])) {
+      return 1;
+    }
+    // ... or the name of a group
+    int count = getPeerGroupMembers(name, targets);
+    if (count < 0) {
+      LOG_ERROR(LOG_SRC_TRANS, "'to' is neither a MAC address nor a known group: %s", name);
+    }
+    return count;
+  }
   
-  char macStr[13];
-  sprintf(macStr, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  if (to.is<JsonArrayConst>()) {
+    int count = 0;
+    for (JsonVariantConst item : to.as<JsonArrayConst>()) {
+      if (count >= ESPNOW_MAX_TARGETS) {
+        LOG_ERROR(LOG_SRC_TRANS, "Too many targets in 'to' (max %d)", ESPNOW_MAX_TARGETS);
+        return -1;
+      }
+      if (!parseMacAddress(item.as<const char*>(), targets[count])) {
+        LOG_ERROR(LOG_SRC_TRANS, "Invalid MAC in 'to' array - must be 12 hex characters");
+        return -1;
+      }
+      count++;
+    }
+    return count;
+  }
   
-  logPrintf("[PEER:%s] From esp-now received %d bytes\n", macStr, len);
+  LOG_ERROR(LOG_SRC_TRANS, "Invalid 'to' field - must be a MAC, group name or array of MACs");
+  return -1;
+}
+
+static bool saveGroups() {
+  if (!preferences.begin(NVS_NAMESPACE, false)) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to open NVS for writing");
+    return false;
+  }
+  size_t written = preferences.putBytes(NVS_GROUPS_KEY, peerGroups, sizeof(peerGroups));
+  preferences.end();
   
-  if (ENABLE_ENCRYPTION) {
-    inPlaceDecrypt(espNowMessageBuffer, len);
-  } else {
-    // Ensure null termination if encryption is disabled
-    if (len < (int)sizeof(espNowMessageBuffer)) {
-      espNowMessageBuffer[len] = '\0';
-    } else {
-      espNowMessageBuffer[sizeof(espNowMessageBuffer) - 1] = '\0';
+  if (written != sizeof(peerGroups)) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to write groups to NVS");
+    return false;
+  }
+  return true;
+}
+
+bool setPeerGroup(const char* name, const uint8_t (*members)[6], int memberCount) {
+  PeerGroup* group = findGroup(name);
+  
+  if (memberCount == 0) {
+    // Empty member list deletes the group
+    if (group == nullptr) {
+      return true;
     }
+    memset(group, 0, sizeof(PeerGroup));
+    return saveGroups();
   }
   
-  // Construct data message to gateway
-  JsonDocument outDoc;
-  outDoc["type"] = "data";
-  outDoc["mac"] = macStr;
-  outDoc["message"] = serialized((char*)espNowMessageBuffer);
-  sendGatewayMessage(outDoc);
+  if (group == nullptr) {
+    for (int i = 0; i < MAX_GROUPS && group == nullptr; i++) {
+      if (peerGroups[i].name[0] == '\0') {
+        group = &peerGroups[i];
+      }
+    }
+    if (group == nullptr) {
+      LOG_ERROR(LOG_SRC_TRANS, "Group table full (max %d groups)", MAX_GROUPS);
+      return false;
+    }
+  }
+  
+  strlcpy(group->name, name, sizeof(group->name));
+  group->count = memberCount;
+  memcpy(group->members, members, memberCount * 6);
+  return saveGroups();
+}
+
+void loadPeerGroups() {
+  if (!preferences.begin(NVS_NAMESPACE, true)) {
+    return;
+  }
+  
+  if (preferences.getBytesLength(NVS_GROUPS_KEY) == sizeof(peerGroups)) {
+    preferences.getBytes(NVS_GROUPS_KEY, peerGroups, sizeof(peerGroups));
+  }
+  preferences.end();
+  
+  for (int i = 0; i < MAX_GROUPS; i++) {
+    if (peerGroups[i].name[0] != '\0') {
+      LOG_INFO(LOG_SRC_TRANS, "Loaded group '%s' with %u peers", peerGroups[i].name, peerGroups[i].count);
+    }
+  }
+}
+
+uint16_t getEspNowPeerCount() {
+  return getPeerDirectoryCount();
+}
+
+// Callback when data is sent (ESP32 signature) – runs in the Wi-Fi task,
+// so only hand the result over to the sender task
+void onEspNowDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  if (txDoneQueue == NULL || txTaskHandle == NULL) {
+    return;
+  }
+  TxCompletion done;
+  memcpy(done.mac, mac_addr, 6);
+  done.status = status;
+  xQueueSend(txDoneQueue, &done, 0);
+  xTaskNotifyGive(txTaskHandle);
+}
+
+// Callback when data is received (ESP32 Arduino 2.x/3.x signature) – runs in
+// the Wi-Fi task, so only copy the frame into the ring and wake the worker
+void onEspNowDataReceived(const uint8_t *mac, const uint8_t *data, int len) {
+  if (rxTaskHandle == NULL) {
+    return;
+  }
+  if (len <= 0 || len > ESPNOW_FRAME_MAX) {
+    rxDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  uint32_t head = rxHead.load(std::memory_order_relaxed);
+  if (head - rxTail.load(std::memory_order_acquire) >= RX_RING_SLOTS) {
+    rxDropped.fetch_add(1, std::memory_order_relaxed);
+    xTaskNotifyGive(rxTaskHandle);
+    return;
+  }
+
+  RxSlot& slot = rxRing[head % RX_RING_SLOTS];
+  memcpy(slot.mac, mac, 6);
+  memcpy(slot.data, data, len);
+  slot.len = len;
+  slot.receivedUs = esp_timer_get_time();
+  rxHead.store(head + 1, std::memory_order_release);
+
+  xTaskNotifyGive(rxTaskHandle);
 }
 
 // Set a custom MAC address and save to NVS
 bool setCustomMacAddress(const uint8_t* macAddress) {
   // Open NVS in write mode
   if (!preferences.begin(NVS_NAMESPACE, false)) {
-    logPrintln("[TRANS] ERROR: Failed to open NVS for writing");
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to open NVS for writing");
     return false;
   }
   
@@ -230,11 +1274,11 @@ bool setCustomMacAddress(const uint8_t* macAddress) {
   preferences.end();
   
   if (written != 6) {
-    logPrintln("[TRANS] ERROR: Failed to write MAC to NVS");
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to write MAC to NVS");
     return false;
   }
   
-  logPrintln("[TRANS] Custom MAC address saved to NVS");
+  LOG_INFO(LOG_SRC_TRANS, "Custom MAC address saved to NVS");
   return true;
 }
 
@@ -248,7 +1292,7 @@ void loadCustomMacAddress() {
   
   // Check if MAC address exists
   if (!preferences.isKey(NVS_MAC_KEY)) {
-    logPrintln("[TRANS] No custom MAC address configured, using default");
+    LOG_INFO(LOG_SRC_TRANS, "No custom MAC address configured, using default");
     preferences.end();
     return;
   }
@@ -259,7 +1303,7 @@ void loadCustomMacAddress() {
   preferences.end();
   
   if (len != 6) {
-    logPrintln("[TRANS] ERROR: Invalid MAC address in NVS");
+    LOG_ERROR(LOG_SRC_TRANS, "Invalid MAC address in NVS");
     return;
   }
   
@@ -269,14 +1313,10 @@ void loadCustomMacAddress() {
   // Apply the custom MAC address
   esp_err_t result = esp_wifi_set_mac(WIFI_IF_STA, customMac);
   if (result == ESP_OK) {
-    logPrint("[TRANS] Custom MAC address loaded: ");
-    for (int i = 0; i < 6; i++) {
-      if (customMac[i] < 16) logPrint("0");
-      logPrint(customMac[i], HEX);
-    }
-    logPrintln();
+    char macStr[13];
+    formatMac(customMac, macStr);
+    LOG_INFO(LOG_SRC_TRANS, "Custom MAC address loaded: %s", macStr);
   } else {
-    logPrint("[TRANS] ERROR: Failed to set custom MAC, code: ");
-    logPrintln(result);
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to set custom MAC, code: %d", result);
   }
 }
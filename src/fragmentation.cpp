@@ -0,0 +1,128 @@
+#include "config.h"  // before fragmentation.h, which has defaults for some settings
+#include "fragmentation.h"
+#include "logger.h"
+
+struct ReassemblySlot {
+  bool used;
+  uint8_t mac[6];
+  uint16_t messageId;
+  uint8_t count;
+  uint32_t received;      // Bit n set = fragment n arrived
+  uint16_t length;        // Message length, known once the last fragment arrived
+  unsigned long startMs;
+  uint8_t data[FRAGMENT_MAX_MESSAGE];
+};
+
+static ReassemblySlot reassembly[FRAGMENT_RX_SLOTS];
+static uint16_t txMessageId = 0;
+
+int fragmentCount(size_t length, size_t chunkSize) {
+  if (chunkSize == 0 || length > FRAGMENT_MAX_MESSAGE) {
+    return 0;
+  }
+  size_t count = (length + chunkSize - 1) / chunkSize;
+  return count <= FRAGMENT_MAX_COUNT ? count : 0;
+}
+
+uint16_t nextFragmentMessageId() {
+  return ++txMessageId;
+}
+
+size_t buildFragment(const uint8_t* payload, size_t length, size_t chunkSize,
+                     uint16_t messageId, int index, int count, uint8_t* out) {
+  size_t offset = index * chunkSize;
+  size_t dataLength = index == count - 1 ? length - offset : chunkSize;
+
+  out[0] = FRAGMENT_MARKER;
+  out[1] = messageId >> 8;
+  out[2] = messageId & 0xFF;
+  out[3] = index;
+  out[4] = count;
+  out[5] = offset >> 8;
+  out[6] = offset & 0xFF;
+  memcpy(out + FRAGMENT_HEADER_LEN, payload + offset, dataLength);
+  return FRAGMENT_HEADER_LEN + dataLength;
+}
+
+// Slot for a message: the one already collecting it, else a free or
+// expired one. Returns nullptr when all slots are busy.
+static ReassemblySlot* findSlot(const uint8_t* mac, uint16_t messageId, bool& isNew) {
+  unsigned long now = millis();
+  ReassemblySlot* free = nullptr;
+  for (int i = 0; i < FRAGMENT_RX_SLOTS; i++) {
+    ReassemblySlot& slot = reassembly[i];
+    if (slot.used && now - slot.startMs >= FRAGMENT_TIMEOUT_MS) {
+      LOG_WARN(LOG_SRC_TRANS, "Fragmented message %u timed out with %d of %d fragments",
+                slot.messageId, __builtin_popcount(slot.received), slot.count);
+      slot.used = false;
+    }
+    if (slot.used && slot.messageId == messageId && memcmp(slot.mac, mac, 6) == 0) {
+      isNew = false;
+      return &slot;
+    }
+    if (!slot.used && free == nullptr) {
+      free = &slot;
+    }
+  }
+  isNew = true;
+  return free;
+}
+
+int reassembleFragment(const uint8_t* mac, const uint8_t* fragment, size_t length, const uint8_t*& message) {
+  if (length <= FRAGMENT_HEADER_LEN || fragment[0] != FRAGMENT_MARKER) {
+    return -1;
+  }
+  uint16_t messageId = (fragment[1] << 8) | fragment[2];
+  uint8_t index = fragment[3];
+  uint8_t count = fragment[4];
+  size_t offset = (fragment[5] << 8) | fragment[6];
+  const uint8_t* data = fragment + FRAGMENT_HEADER_LEN;
+  size_t dataLength = length - FRAGMENT_HEADER_LEN;
+  bool last = index == count - 1;
+
+  // Every fragment but the last is full, so it bounds the message size
+  size_t bound = last ? offset + dataLength : count * dataLength;
+  if (count == 0 || count > FRAGMENT_MAX_COUNT || index >= count || bound > FRAGMENT_MAX_MESSAGE ||
+      (!last && offset != index * dataLength)) {
+    return -1;
+  }
+
+  bool isNew;
+  ReassemblySlot* slot = findSlot(mac, messageId, isNew);
+  if (slot == nullptr) {
+    LOG_ERROR(LOG_SRC_TRANS, "Reassembly table full, fragment dropped");
+    return -1;
+  }
+  if (isNew) {
+    slot->used = true;
+    memcpy(slot->mac, mac, 6);
+    slot->messageId = messageId;
+    slot->count = count;
+    slot->received = 0;
+    slot->length = 0;
+    slot->startMs = millis();
+  }
+  if (slot->count != count) {
+    return -1;
+  }
+
+  uint32_t bit = 1UL << index;
+  if ((slot->received & bit) == 0) {
+    memcpy(slot->data + offset, data, dataLength);
+    slot->received |= bit;
+    if (last) {
+      slot->length = offset + dataLength;
+    }
+  }
+
+  uint32_t complete = count == 32 ? 0xFFFFFFFFUL : (1UL << count) - 1;
+  if (slot->received != complete) {
+    return 0;
+  }
+
+  // The slot is reused only after the caller has forwarded the message
+  // (the receive task handles one frame at a time)
+  slot->used = false;
+  message = slot->data;
+  return slot->length;
+}
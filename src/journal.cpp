@@ -0,0 +1,311 @@
+#include "config.h"  // before journal.h, which has defaults for some settings
+#include "journal.h"
+#include "compression.h"
+#include "logger.h"
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#define JOURNAL_DIR "/journal"
+#define JOURNAL_MAGIC 'J'
+#define JOURNAL_FLAG_COMPRESSED 0x01
+
+// An error line brings the pending block forward to this delay
+#define JOURNAL_ERROR_FLUSH_MS 2000
+
+// NVS storage for the boot counter
+#define NVS_NAMESPACE "espnow_gw"
+#define NVS_BOOT_KEY "log_boot"
+
+struct JournalBlockHeader {
+  uint8_t magic;
+  uint8_t flags;
+  uint16_t boot;
+  uint16_t rawLength;
+  uint16_t storedLength;
+};
+
+static_assert(JOURNAL_BLOCK_BYTES <= 32768, "JOURNAL_BLOCK_BYTES too large for compressBlock()");
+
+static bool journalReady = false;
+static uint16_t bootNumber = 0;
+static uint32_t newestFile = 0;   // Blocks are appended to this file
+static uint32_t oldestFile = 0;
+static bool writeFailed = false;  // Reported once, the report itself goes into the journal
+
+// File access from the log task (writes) and the web server / loop() (reads)
+static SemaphoreHandle_t journalMutex = NULL;
+
+// Pending block (log task only)
+static char pendingBlock[JOURNAL_BLOCK_BYTES];
+static size_t pendingLength = 0;
+static uint32_t pendingDueMs = 0;
+static uint8_t storedBlock[JOURNAL_BLOCK_BYTES];
+
+// Block being read for getJournalPage() (under journalMutex)
+static uint8_t readStored[JOURNAL_BLOCK_BYTES];
+static char readRaw[JOURNAL_BLOCK_BYTES + 1];
+
+static void journalPath(uint32_t number, char* path) {
+  sprintf(path, JOURNAL_DIR "/%lu.bin", (unsigned long)number);
+}
+
+// Number of intact blocks in a file; a torn block at the end (power loss
+// during a write) and everything after it is ignored
+static uint32_t countBlocks(File& file, uint32_t stopAt, size_t& position) {
+  size_t size = file.size();
+  position = 0;
+  uint32_t count = 0;
+  while (count < stopAt && position + sizeof(JournalBlockHeader) <= size) {
+    JournalBlockHeader header;
+    file.seek(position);
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != JOURNAL_MAGIC ||
+        header.rawLength > JOURNAL_BLOCK_BYTES || header.storedLength > JOURNAL_BLOCK_BYTES ||
+        position + sizeof(header) + header.storedLength > size) {
+      break;
+    }
+    position += sizeof(header) + header.storedLength;
+    count++;
+  }
+  return count;
+}
+
+bool setupJournal() {
+  journalMutex = xSemaphoreCreateMutex();
+
+  // Format the partition on first use
+  if (!LittleFS.begin(true)) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to mount LittleFS, log journal disabled");
+    return false;
+  }
+  LittleFS.mkdir(JOURNAL_DIR);
+
+  Preferences preferences;
+  if (preferences.begin(NVS_NAMESPACE, false)) {
+    bootNumber = preferences.getUInt(NVS_BOOT_KEY, 0) + 1;
+    preferences.putUInt(NVS_BOOT_KEY, bootNumber);
+    preferences.end();
+  }
+
+  // Files are numbered in the order they were started
+  bool found = false;
+  File dir = LittleFS.open(JOURNAL_DIR);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    const char* name = strrchr(file.name(), '/');
+    uint32_t number = strtoul(name != nullptr ? name + 1 : file.name(), nullptr, 10);
+    if (!found || number > newestFile) newestFile = number;
+    if (!found || number < oldestFile) oldestFile = number;
+    found = true;
+    file.close();
+  }
+  dir.close();
+
+  // Never append behind a torn block
+  if (found) {
+    char path[32];
+    journalPath(newestFile, path);
+    File file = LittleFS.open(path, "r");
+    size_t intact = 0;
+    countBlocks(file, UINT32_MAX, intact);
+    if (intact != file.size()) {
+      newestFile++;
+    }
+    file.close();
+  }
+
+  journalReady = true;
+  LOG_INFO(LOG_SRC_TRANS, "Log journal ready (boot %u, %u of %u KB used)", bootNumber,
+           (unsigned)(LittleFS.usedBytes() / 1024), (unsigned)(LittleFS.totalBytes() / 1024));
+  return true;
+}
+
+static void writeBlock() {
+  JournalBlockHeader header;
+  header.magic = JOURNAL_MAGIC;
+  header.boot = bootNumber;
+  header.rawLength = pendingLength;
+
+  // Keep the block as-is when compression does not make it smaller
+  int compressed = compressBlock((const uint8_t*)pendingBlock, pendingLength, storedBlock, pendingLength - 1);
+  const uint8_t* data = (const uint8_t*)pendingBlock;
+  header.flags = 0;
+  header.storedLength = pendingLength;
+  if (compressed > 0) {
+    data = storedBlock;
+    header.flags = JOURNAL_FLAG_COMPRESSED;
+    header.storedLength = compressed;
+  }
+
+  xSemaphoreTake(journalMutex, portMAX_DELAY);
+  char path[32];
+  journalPath(newestFile, path);
+  File file = LittleFS.open(path, "a");
+  if (file && file.size() + sizeof(header) + header.storedLength > JOURNAL_FILE_BYTES) {
+    // Start the next file and drop the oldest ones
+    file.close();
+    newestFile++;
+    while (newestFile - oldestFile >= JOURNAL_FILES) {
+      journalPath(oldestFile++, path);
+      LittleFS.remove(path);
+    }
+    journalPath(newestFile, path);
+    file = LittleFS.open(path, "a");
+  }
+  bool ok = file && file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+            file.write(data, header.storedLength) == header.storedLength;
+  if (file) {
+    file.close();
+  }
+  xSemaphoreGive(journalMutex);
+
+  pendingLength = 0;
+  if (!ok && !writeFailed) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to write log journal block, further failures are not reported");
+  } else if (ok && writeFailed) {
+    LOG_INFO(LOG_SRC_TRANS, "Log journal writes work again");
+  }
+  writeFailed = !ok;
+}
+
+void journalAppend(uint32_t id, uint32_t timestampMs, uint8_t level, const char* line, size_t length) {
+  if (!journalReady) {
+    return;
+  }
+
+  char prefix[32];
+  int prefixLength = snprintf(prefix, sizeof(prefix), "%lu %lu %u ", (unsigned long)id, (unsigned long)timestampMs, level);
+  size_t entryLength = prefixLength + length + 1;
+  if (entryLength > JOURNAL_BLOCK_BYTES) {
+    return;
+  }
+  if (pendingLength + entryLength > JOURNAL_BLOCK_BYTES) {
+    writeBlock();
+  }
+
+  uint32_t now = millis();
+  if (pendingLength == 0) {
+    pendingDueMs = now + JOURNAL_FLUSH_MS;
+  }
+  if (level == LOG_LEVEL_ERROR && (int32_t)(pendingDueMs - (now + JOURNAL_ERROR_FLUSH_MS)) > 0) {
+    pendingDueMs = now + JOURNAL_ERROR_FLUSH_MS;
+  }
+
+  memcpy(pendingBlock + pendingLength, prefix, prefixLength);
+  memcpy(pendingBlock + pendingLength + prefixLength, line, length);
+  pendingBlock[pendingLength + entryLength - 1] = '\n';
+  pendingLength += entryLength;
+}
+
+void journalFlush(bool force) {
+  if (pendingLength > 0 && (force || (int32_t)(millis() - pendingDueMs) >= 0)) {
+    writeBlock();
+  }
+}
+
+uint32_t journalFlushDelayMs() {
+  if (pendingLength == 0) {
+    return portMAX_DELAY;
+  }
+  int32_t remaining = pendingDueMs - millis();
+  return remaining > 0 ? remaining : 0;
+}
+
+// Read block number index (0 = newest) into readRaw; returns its length, -1 if missing
+static int readBlock(uint32_t index, uint32_t& pages, uint16_t& boot) {
+  pages = 0;
+  int length = -1;
+  char path[32];
+  for (uint32_t number = newestFile + 1; number-- > oldestFile;) {
+    journalPath(number, path);
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+      continue;
+    }
+    size_t end;
+    uint32_t count = countBlocks(file, UINT32_MAX, end);
+    if (length < 0 && index >= pages && index < pages + count) {
+      // Blocks are counted from the start of the file, pages from its end
+      size_t position;
+      countBlocks(file, count - 1 - (index - pages), position);
+      JournalBlockHeader header;
+      file.seek(position);
+      file.read((uint8_t*)&header, sizeof(header));
+      if (file.read(readStored, header.storedLength) == header.storedLength) {
+        boot = header.boot;
+        if (header.flags & JOURNAL_FLAG_COMPRESSED) {
+          length = decompressBlock(readStored, header.storedLength, (uint8_t*)readRaw, JOURNAL_BLOCK_BYTES);
+        } else {
+          memcpy(readRaw, readStored, header.storedLength);
+          length = header.storedLength;
+        }
+      }
+    }
+    pages += count;
+    file.close();
+  }
+  return length;
+}
+
+static void formatUptime(uint32_t totalMillis, char* out) {
+  unsigned long hours = totalMillis / 3600000;
+  unsigned long minutes = (totalMillis % 3600000) / 60000;
+  unsigned long seconds = (totalMillis % 60000) / 1000;
+  unsigned long ms = totalMillis % 1000;
+  sprintf(out, "%02lu:%02lu:%02lu.%03lu", hours, minutes, seconds, ms);
+}
+
+bool getJournalPage(uint32_t page, size_t offset, size_t limit, JsonObject out) {
+  if (!journalReady) {
+    return false;
+  }
+
+  xSemaphoreTake(journalMutex, portMAX_DELAY);
+  uint32_t pages;
+  uint16_t boot = 0;
+  int length = readBlock(page, pages, boot);
+  if (length < 0) {
+    xSemaphoreGive(journalMutex);
+    return false;
+  }
+
+  out["page"] = page;
+  out["pages"] = pages;
+  out["boot"] = boot;
+  JsonArray entries = out["entries"].to<JsonArray>();
+
+  readRaw[length] = '\0';
+  char* line = readRaw;
+  size_t index = 0;
+  while (*line != '\0') {
+    char* next = strchr(line, '\n');
+    if (next == nullptr) {
+      break;
+    }
+    *next = '\0';
+
+    if (index >= offset && index - offset >= limit) {
+      out["next_offset"] = index;
+      break;
+    }
+    if (index >= offset) {
+      // "<id> <uptime ms> <level> <text>"
+      char* text;
+      uint32_t id = strtoul(line, &text, 10);
+      uint32_t timestampMs = strtoul(text, &text, 10);
+      uint8_t level = strtoul(text, &text, 10);
+      char timeBuf[32];
+      formatUptime(timestampMs, timeBuf);
+
+      JsonObject entry = entries.add<JsonObject>();
+      entry["id"] = id;
+      entry["timestamp"] = (const char*)timeBuf;
+      entry["level"] = logLevelName(level);
+      entry["message"] = (const char*)(*text == ' ' ? text + 1 : text);
+    }
+    index++;
+    line = next + 1;
+  }
+  xSemaphoreGive(journalMutex);
+  return true;
+}
@@ -1,235 +1,709 @@
+#include "config.h"  // before logger.h, which has defaults for some settings
 #include "logger.h"
-#include "config.h"
-#include <stdarg.h>
-#include <deque>
+#include "serial_framing.h"
+#include "journal.h"
 #include <ArduinoJson.h>
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <atomic>
 
 // UART2 configuration
 #define UART2_TX_PIN 17
 #define UART2_RX_PIN 16
+#ifndef UART2_BAUD
 #define UART2_BAUD 115200
+#endif
+
+// Room for several full messages at the higher baud rates between two loop() iterations
+#define UART2_RX_BUFFER_SIZE 2048
+
+// NVS storage for the negotiated baud rate
+#define NVS_NAMESPACE "espnow_gw"
+#define NVS_BAUD_KEY "uart2_baud"
 
 // UART2 instance
 static HardwareSerial uart2(2);
+static uint32_t uart2Baud = UART2_BAUD;
+
+// Binary frames are built in shared buffers (too large for the task stacks),
+// one message at a time
+static SemaphoreHandle_t frameMutex = NULL;
+static char frameJson[FRAME_MAX_SIZE];
+static uint8_t frameBuffer[FRAME_MAX_SIZE];
+static uint8_t frameEncoded[FRAME_ENCODED_SIZE(FRAME_MAX_SIZE)];
 
-// Circular log buffer structures
-struct LogLine {
+// In-memory log: records in a fixed byte arena, oldest dropped first
+#ifndef LOG_BUFFER_BYTES
+#define LOG_BUFFER_BYTES 8192
+#endif
+
+// Longer lines are truncated
+#define LOG_LINE_MAX 256
+
+// Record: header followed by the text (null-terminated). A length of
+// LOG_RECORD_WRAP marks the end of the used arena, reading continues at 0.
+struct LogRecord {
+  uint16_t length;  // Text length without the terminator
+  uint8_t level;
   uint32_t id;
-  unsigned long timestampMs;
-  String message;
+  uint32_t timestampMs;
 };
 
-static std::deque<LogLine> logBuffer;
+#define LOG_RECORD_WRAP 0xFFFF
+
+static_assert(LOG_BUFFER_BYTES >= 2 * (sizeof(LogRecord) + LOG_LINE_MAX + 1), "LOG_BUFFER_BYTES too small");
+
+static uint8_t logArena[LOG_BUFFER_BYTES];
+static size_t logHead = 0;   // Oldest record
+static size_t logTail = 0;   // Next record is written here
+static size_t logRecords = 0;
 static uint32_t logCounter = 0;
-static String currentLineBuffer = "";
-static const size_t MAX_LOG_LINES = 100;
-
-// Forward declaration
-static void handleCompletedLogLine(const String& line);
-
-// Internal helper to buffer printed text into complete lines
-static void bufferLogText(const String& text) {
-  for (size_t i = 0; i < text.length(); i++) {
-    char c = text[i];
-    if (c == '\n') {
-      // Clean up log message (only keep printable ASCII 32-126)
-      String safeMsg = "";
-      for (size_t j = 0; j < currentLineBuffer.length(); j++) {
-        char ch = currentLineBuffer[j];
-        if (ch >= 32 && ch <= 126) {
-          safeMsg += ch;
-        }
-      }
-      
-      LogLine entry;
-      entry.id = ++logCounter;
-      entry.timestampMs = millis();
-      entry.message = safeMsg;
-      logBuffer.push_back(entry);
-      if (logBuffer.size() > MAX_LOG_LINES) {
-        logBuffer.pop_front();
-      }
-      
-      handleCompletedLogLine(safeMsg);
-      
-      currentLineBuffer = "";
-    } else if (c != '\r') {
-      currentLineBuffer += c;
-    }
+
+// The arena is written by the log task and read by the web server
+static SemaphoreHandle_t logMutex = NULL;
+
+// Log queue: any task appends records without blocking, the log task formats
+// them and writes them to the arena, USB and UART2.
+// Bounded MPSC queue with a sequence number per slot; the stored value is
+// relative to the slot index so the zeroed queue is ready before setupLogger().
+#ifndef LOG_QUEUE_SLOTS
+#define LOG_QUEUE_SLOTS 32
+#endif
+
+static_assert((LOG_QUEUE_SLOTS & (LOG_QUEUE_SLOTS - 1)) == 0, "LOG_QUEUE_SLOTS must be a power of two");
+
+struct LogQueueSlot {
+  std::atomic<uint32_t> sequence;  // Minus the slot index
+  uint8_t level;
+  LogSource source;
+  uint8_t mac[6];                  // LOG_SRC_PEER only
+  uint32_t timestampMs;
+  const char* format;
+  LogArgs args;
+};
+
+static LogQueueSlot logQueue[LOG_QUEUE_SLOTS];
+static std::atomic<uint32_t> logQueueHead(0);     // claimed by producers
+static uint32_t logQueueTail = 0;                 // advanced by the log task only
+static std::atomic<uint32_t> logQueueDropped(0);  // records lost because the queue was full
+static TaskHandle_t logTaskHandle = NULL;
+static std::atomic<bool> journalFlushRequested(false);  // set by flushLogs()
+
+#define LOG_TASK_STACK_SIZE 4096
+#define LOG_TASK_PRIORITY 1  // Same as loop(), below the ESP-NOW and network tasks
+
+static const char* const LOG_LEVEL_NAMES[] = {"debug", "info", "warning", "error"};
+
+// Output sinks: minimum level per sink (USB, UART2, flash journal), and a
+// token bucket for the UART2 mirror so log lines cannot crowd out data
+// messages on the link.
+// (The in-memory log keeps every record.)
+#ifndef LOG_USB_LEVEL
+#define LOG_USB_LEVEL LOG_LEVEL_DEBUG
+#endif
+#ifndef LOG_UART_LEVEL
+#define LOG_UART_LEVEL LOG_LEVEL_INFO
+#endif
+#ifndef LOG_UART_RATE
+#define LOG_UART_RATE 10   // Lines per second, 0 = unlimited
+#endif
+#ifndef LOG_UART_BURST
+#define LOG_UART_BURST 20  // Lines sent back-to-back after a quiet period
+#endif
+#ifndef LOG_JOURNAL_LEVEL
+#define LOG_JOURNAL_LEVEL LOG_LEVEL_INFO
+#endif
+
+static LogSinkConfig sinkConfig = {LOG_USB_LEVEL, LOG_UART_LEVEL, LOG_UART_RATE, LOG_UART_BURST, LOG_JOURNAL_LEVEL};
+static uint32_t uartTokens = LOG_UART_BURST * 1000;  // In 1/1000 lines (log task only)
+static uint32_t uartRefillMs = 0;
+static uint32_t uartThrottled = 0;                   // Lines not mirrored since throttling began
+static std::atomic<uint32_t> uartDroppedTotal(0);
+static const char* const LOG_SOURCE_NAMES[] = {"TRANS", "BTN", "DRY RUN", "PEER", "TRANS"};
+
+static size_t logRecordSize(size_t textLength) {
+  return sizeof(LogRecord) + textLength + 1;
+}
+
+// Position of the record at pos, following a wrap marker or the arena end
+static size_t logRecordAt(size_t pos) {
+  if (pos + sizeof(uint16_t) > LOG_BUFFER_BYTES) {
+    return 0;
   }
+  uint16_t length;
+  memcpy(&length, logArena + pos, sizeof(length));
+  return length == LOG_RECORD_WRAP ? 0 : pos;
 }
 
-void setupLogger() {
-  // Initialize USB Serial (UART0) for debugging
-  Serial.begin(115200);
-  
-  // Initialize UART2 for MQTT module communication
-  uart2.begin(UART2_BAUD, SERIAL_8N1, UART2_RX_PIN, UART2_TX_PIN);
-  
-  // Wait a bit for serial ports to stabilize
-  delay(100);
+static void dropOldestLogRecord() {
+  LogRecord header;
+  memcpy(&header, logArena + logHead, sizeof(header));
+  logRecords--;
+  if (logRecords == 0) {
+    logHead = logTail = 0;
+    return;
+  }
+  logHead = logRecordAt(logHead + logRecordSize(header.length));
 }
 
-void sendGatewayMessage(const JsonDocument& doc) {
-  String out;
-  serializeJson(doc, out);
-  uart2.println(out);
+// Returns the record ID
+static uint32_t storeLogLine(uint8_t level, uint32_t timestampMs, const char* text, size_t length) {
+  size_t size = logRecordSize(length);
+
+  // Find room at logTail, dropping the oldest records when the arena is full
+  for (;;) {
+    if (logRecords == 0) {
+      logHead = logTail = 0;
+      break;
+    }
+    if (logHead < logTail) {
+      // Used: [head, tail), free: [tail, end) and [0, head)
+      if (logTail + size <= LOG_BUFFER_BYTES) {
+        break;
+      }
+      if (logTail + sizeof(uint16_t) <= LOG_BUFFER_BYTES) {
+        uint16_t wrap = LOG_RECORD_WRAP;
+        memcpy(logArena + logTail, &wrap, sizeof(wrap));
+      }
+      logTail = 0;
+      continue;
+    }
+    // Wrapped – used: [head, end) and [0, tail), free: [tail, head)
+    if (logTail + size <= logHead) {
+      break;
+    }
+    dropOldestLogRecord();
+  }
+
+  LogRecord header;
+  header.length = length;
+  header.level = level;
+  header.id = ++logCounter;
+  header.timestampMs = timestampMs;
+  memcpy(logArena + logTail, &header, sizeof(header));
+  memcpy(logArena + logTail + sizeof(header), text, length);
+  logArena[logTail + sizeof(header) + length] = '\0';
+  logTail += size;
+  logRecords++;
+  return header.id;
 }
 
-static void handleCompletedLogLine(const String& line) {
-  String cleanMsg = line;
-  
-  // Skip empty lines
-  if (cleanMsg.length() == 0) {
+void logPackArg(LogArgs& args, LogArgType type, const void* value, size_t length) {
+  if (args.truncated) {
     return;
   }
-  
-  // Skip raw data messages if they are somehow passed here (safety check)
-  if (cleanMsg.startsWith("DATA:")) {
+  size_t room = LOG_ARGS_BYTES - args.used;
+  if (type == LOG_ARG_STRING) {
+    // Type, length, text, terminator – truncated to the room left
+    if (room < 3) {
+      args.truncated = true;
+      return;
+    }
+    if (length > room - 3) {
+      length = room - 3;
+    }
+    args.data[args.used] = type;
+    args.data[args.used + 1] = length;
+    memcpy(args.data + args.used + 2, value, length);
+    args.data[args.used + 2 + length] = '\0';
+    args.used += length + 3;
     return;
   }
-  
-  String level = "info";
-  String from = WHO_AM_I;
-  
-  // Check for Peer tag prefix [PEER:AABBCCDDEEFF]
-  if (cleanMsg.startsWith("[PEER:")) {
-    int closeBracket = cleanMsg.indexOf(']');
-    if (closeBracket > 6) {
-      from = cleanMsg.substring(6, closeBracket);
-      cleanMsg = cleanMsg.substring(closeBracket + 1);
-      cleanMsg.trim();
-    }
-  } else if (cleanMsg.startsWith("[TRANS] ")) {
-    cleanMsg = cleanMsg.substring(8);
-  } else if (cleanMsg.startsWith("[DRY RUN] ")) {
-    cleanMsg = cleanMsg.substring(10);
-    level = "debug";
+  if (room < length + 1) {
+    // Later arguments would no longer match the format
+    args.truncated = true;
+    return;
   }
-  
-  // Check for level indicators in the message text
-  if (cleanMsg.startsWith("ERROR: ")) {
-    level = "error";
-    cleanMsg = cleanMsg.substring(7);
-  } else if (cleanMsg.startsWith("WARNING: ")) {
-    level = "warning";
-    cleanMsg = cleanMsg.substring(9);
-  } else if (cleanMsg.indexOf("ERROR") >= 0 || cleanMsg.indexOf("failed") >= 0 || cleanMsg.indexOf("fail") >= 0) {
-    level = "error";
-  } else if (cleanMsg.indexOf("WARNING") >= 0) {
-    level = "warning";
+  args.data[args.used] = type;
+  memcpy(args.data + args.used + 1, value, length);
+  args.used += length + 1;
+}
+
+void logWrite(uint8_t level, LogSource source, const uint8_t* mac, const char* format, const LogArgs& args) {
+  // Claim the next free slot
+  LogQueueSlot* slot;
+  uint32_t pos = logQueueHead.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = &logQueue[pos % LOG_QUEUE_SLOTS];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire) + pos % LOG_QUEUE_SLOTS;
+    int32_t diff = (int32_t)(sequence - pos);
+    if (diff == 0) {
+      if (logQueueHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      logQueueDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = logQueueHead.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->level = level;
+  slot->source = source;
+  if (mac != nullptr) {
+    memcpy(slot->mac, mac, 6);
+  }
+  slot->timestampMs = millis();
+  slot->format = format;
+  slot->args.used = args.used;
+  slot->args.truncated = args.truncated;
+  memcpy(slot->args.data, args.data, args.used);
+  slot->sequence.store(pos + 1 - pos % LOG_QUEUE_SLOTS, std::memory_order_release);
+
+  if (logTaskHandle != NULL) {
+    xTaskNotifyGive(logTaskHandle);
   }
-  
-  // Format log message as JSON and send to UART2 (gateway)
-  JsonDocument doc;
-  doc["type"] = "log";
-  doc["from"] = from;
-  doc["level"] = level;
-  doc["message"] = cleanMsg;
-  
-  sendGatewayMessage(doc);
 }
 
-void logPrint(const char* message) {
-  Serial.print(message);
-  bufferLogText(message);
+// printf with the packed arguments. Length modifiers in the format are
+// ignored – the argument carries its own size. Missing or mismatched
+// arguments print as '?'.
+static size_t formatLogMessage(const char* format, const LogArgs& args, char* out, size_t capacity) {
+  size_t write = 0;
+  size_t read = 0;
+  while (*format != '\0' && write < capacity - 1) {
+    if (*format != '%') {
+      out[write++] = *format++;
+      continue;
+    }
+    if (format[1] == '%') {
+      out[write++] = '%';
+      format += 2;
+      continue;
+    }
+
+    // Flags, width and precision are kept, the length is set per argument
+    char spec[16];
+    size_t specLength = 0;
+    spec[specLength++] = *format++;
+    while (*format != '\0' && strchr("-+ #0123456789.", *format) != nullptr) {
+      if (specLength < sizeof(spec) - 4) {
+        spec[specLength++] = *format;
+      }
+      format++;
+    }
+    while (*format != '\0' && strchr("hlLqjzt", *format) != nullptr) {
+      format++;
+    }
+    char conversion = *format;
+    if (conversion == '\0') {
+      break;
+    }
+    format++;
+
+    if (read + 1 >= args.used) {
+      out[write++] = '?';
+      continue;
+    }
+    LogArgType type = (LogArgType)args.data[read];
+    const uint8_t* value = args.data + read + 1;
+    size_t size = type == LOG_ARG_STRING ? value[0] + 3 : 9;
+    if (read + size > args.used) {
+      read = args.used;
+      out[write++] = '?';
+      continue;
+    }
+    read += size;
+
+    int64_t integer = 0;
+    double real = 0;
+    if (type == LOG_ARG_DOUBLE) {
+      memcpy(&real, value, sizeof(real));
+    } else if (type != LOG_ARG_STRING) {
+      memcpy(&integer, value, sizeof(integer));
+    }
+
+    size_t room = capacity - write;
+    int printed = -1;
+    if (strchr("di", conversion) != nullptr && type != LOG_ARG_STRING && type != LOG_ARG_DOUBLE) {
+      memcpy(spec + specLength, "lld", 4);
+      printed = snprintf(out + write, room, spec, (long long)integer);
+    } else if (strchr("uoxX", conversion) != nullptr && type != LOG_ARG_STRING && type != LOG_ARG_DOUBLE) {
+      if (type == LOG_ARG_INT32) {
+        integer = (uint32_t)integer;  // As the 32-bit value would print
+      }
+      spec[specLength] = 'l';
+      spec[specLength + 1] = 'l';
+      spec[specLength + 2] = conversion;
+      spec[specLength + 3] = '\0';
+      printed = snprintf(out + write, room, spec, (unsigned long long)integer);
+    } else if (conversion == 'c' && type != LOG_ARG_STRING && type != LOG_ARG_DOUBLE) {
+      memcpy(spec + specLength, "c", 2);
+      printed = snprintf(out + write, room, spec, (int)integer);
+    } else if (strchr("fFeEgG", conversion) != nullptr && type != LOG_ARG_STRING) {
+      spec[specLength] = conversion;
+      spec[specLength + 1] = '\0';
+      printed = snprintf(out + write, room, spec, type == LOG_ARG_DOUBLE ? real : (double)integer);
+    } else if (conversion == 's' && type == LOG_ARG_STRING) {
+      memcpy(spec + specLength, "s", 2);
+      printed = snprintf(out + write, room, spec, (const char*)value + 1);
+    } else if (conversion == 'p' && type == LOG_ARG_POINTER) {
+      memcpy(spec + specLength, "p", 2);
+      printed = snprintf(out + write, room, spec, (void*)(uintptr_t)integer);
+    }
+
+    if (printed < 0) {
+      out[write++] = '?';
+    } else {
+      write += (size_t)printed < room ? printed : room - 1;
+    }
+  }
+  out[write] = '\0';
+  return write;
 }
 
-void logPrint(const String& message) {
-  Serial.print(message);
-  bufferLogText(message);
+// Token bucket of the UART2 mirror (log task)
+static bool takeUartToken(const LogSinkConfig& config) {
+  uint32_t now = millis();
+  uint32_t capacity = (uint32_t)config.uartBurst * 1000;
+  uint64_t tokens = uartTokens + (uint64_t)(now - uartRefillMs) * config.uartRate;
+  uartTokens = tokens < capacity ? tokens : capacity;
+  uartRefillMs = now;
+
+  if (config.uartRate == 0) {
+    return true;
+  }
+  if (uartTokens < 1000) {
+    return false;
+  }
+  uartTokens -= 1000;
+  return true;
 }
 
-void logPrint(int value) {
-  Serial.print(value);
-  bufferLogText(String(value));
+// Write one JSON message to UART2 in the current framing (frameMutex held).
+// In JSON-line mode json must have room for two more bytes.
+static void writeGatewayJson(char* json, size_t length) {
+  if (getSerialFraming() == FRAMING_BINARY) {
+    FrameWriter writer;
+    frameBegin(writer, frameBuffer, sizeof(frameBuffer), FRAME_JSON);
+    frameAddTlv(writer, TLV_JSON, json, length);
+    size_t encodedLen = frameFinish(writer, frameEncoded, sizeof(frameEncoded));
+    if (encodedLen > 0) {
+      uart2.write(frameEncoded, encodedLen);
+    }
+    return;
+  }
+  json[length++] = '\r';
+  json[length++] = '\n';
+  uart2.write((const uint8_t*)json, length);
 }
 
-void logPrint(unsigned int value) {
-  Serial.print(value);
-  bufferLogText(String(value));
+// Append text as a quoted JSON string, truncated to fit before end
+// (log text is printable ASCII, so only quotes and backslashes need escaping)
+static size_t appendJsonString(char* out, size_t pos, size_t end, const char* text) {
+  out[pos++] = '"';
+  for (; *text != '\0' && pos + 2 < end; text++) {
+    if (*text == '"' || *text == '\\') {
+      out[pos++] = '\\';
+    }
+    out[pos++] = *text;
+  }
+  out[pos++] = '"';
+  return pos;
 }
 
-void logPrint(long value) {
-  Serial.print(value);
-  bufferLogText(String(value));
+// Mirror a log line to the gateway as a "log" message, built in a static
+// buffer instead of a JsonDocument (log task only)
+static void sendLogEnvelope(const char* from, uint8_t level, const char* message) {
+  // Worst case every character escaped, plus the keys and CR LF
+  static char envelope[2 * LOG_LINE_MAX + 128];
+  const size_t end = sizeof(envelope) - 4;  // Room for '}' and CR LF
+
+  size_t pos = snprintf(envelope, end, "{\"type\":\"log\",\"from\":");
+  pos = appendJsonString(envelope, pos, end, from);
+  int printed = snprintf(envelope + pos, end - pos, ",\"level\":\"%s\",\"message\":", LOG_LEVEL_NAMES[level]);
+  pos += (size_t)printed < end - pos ? printed : end - pos - 1;
+  pos = appendJsonString(envelope, pos, end, message);
+  envelope[pos++] = '}';
+
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  writeGatewayJson(envelope, pos);
+  xSemaphoreGive(frameMutex);
 }
 
-void logPrint(unsigned long value) {
-  Serial.print(value);
-  bufferLogText(String(value));
+// Tell the gateway how many lines were not mirrored, once lines pass again
+static void reportUartThrottling() {
+  if (uartThrottled == 0) {
+    return;
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "%u log lines not mirrored (rate limit)", (unsigned)uartThrottled);
+  uartThrottled = 0;
+  Serial.printf("[TRANS] WARNING: %s\n", message);
+  sendLogEnvelope(WHO_AM_I, LOG_LEVEL_WARNING, message);
 }
 
-void logPrint(uint8_t value, int format) {
-  Serial.print(value, format);
-  bufferLogText(String(value, format));
+// Format a record and write it to the arena, USB and UART2 (log task)
+static void emitLogRecord(uint8_t level, LogSource source, const uint8_t* mac, uint32_t timestampMs,
+                          const char* format, const LogArgs& args) {
+  static char message[LOG_LINE_MAX + 1];
+  static char line[LOG_LINE_MAX + 1];
+  size_t messageLength = formatLogMessage(format, args, message, sizeof(message));
+
+  // Only keep printable ASCII 32-126
+  size_t kept = 0;
+  for (size_t i = 0; i < messageLength; i++) {
+    if (message[i] >= 32 && message[i] <= 126) {
+      message[kept++] = message[i];
+    }
+  }
+  message[kept] = '\0';
+
+  // Text line for USB and the Web UI: "[TRANS] ERROR: ..." / "[PEER:AABBCCDDEEFF] ..."
+  char from[13];
+  if (source == LOG_SRC_PEER) {
+    sprintf(from, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+  int lineLength = snprintf(line, sizeof(line), "[%s%s%s] %s%s", LOG_SOURCE_NAMES[source],
+                            source == LOG_SRC_PEER ? ":" : "", source == LOG_SRC_PEER ? from : "",
+                            level == LOG_LEVEL_ERROR ? "ERROR: " : level == LOG_LEVEL_WARNING ? "WARNING: " : "",
+                            message);
+  if (lineLength >= (int)sizeof(line)) {
+    lineLength = sizeof(line) - 1;
+  }
+
+  xSemaphoreTake(logMutex, portMAX_DELAY);
+  uint32_t id = storeLogLine(level, timestampMs, line, lineLength);
+  LogSinkConfig config = sinkConfig;
+  xSemaphoreGive(logMutex);
+
+  if (level >= config.journalLevel) {
+    journalAppend(id, timestampMs, level, line, lineLength);
+  }
+
+  if (level >= config.usbLevel) {
+    Serial.write((const uint8_t*)line, lineLength);
+    Serial.println();
+  }
+
+  if (level < config.uartLevel || source == LOG_SRC_LINK) {
+    return;
+  }
+  if (!takeUartToken(config)) {
+    uartThrottled++;
+    uartDroppedTotal.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  reportUartThrottling();
+
+  // Format log message as JSON and send to UART2 (gateway)
+  sendLogEnvelope(source == LOG_SRC_PEER ? from : WHO_AM_I, level, message);
 }
 
-void logPrintln(const char* message) {
-  Serial.println(message);
-  bufferLogText(String(message) + "\n");
+static void logTask(void* parameter) {
+  for (;;) {
+    // Wake up for a due journal block, and now and then to report the end
+    // of UART2 throttling while the log is quiet
+    uint32_t waitMs = journalFlushDelayMs();
+    if (uartThrottled > 0 && waitMs > 1000) {
+      waitMs = 1000;
+    }
+    ulTaskNotifyTake(pdTRUE, waitMs == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+
+    for (;;) {
+      LogQueueSlot& slot = logQueue[logQueueTail % LOG_QUEUE_SLOTS];
+      uint32_t sequence = slot.sequence.load(std::memory_order_acquire) + logQueueTail % LOG_QUEUE_SLOTS;
+      if (sequence != logQueueTail + 1) {
+        break;  // Empty, or the producer is still writing the slot
+      }
+      emitLogRecord(slot.level, slot.source, slot.mac, slot.timestampMs, slot.format, slot.args);
+      slot.sequence.store(logQueueTail + LOG_QUEUE_SLOTS - logQueueTail % LOG_QUEUE_SLOTS, std::memory_order_release);
+      logQueueTail++;
+    }
+
+    uint32_t dropped = logQueueDropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      LogArgs args;
+      args.used = 0;
+      args.truncated = false;
+      logPack(args, dropped);
+      emitLogRecord(LOG_LEVEL_WARNING, LOG_SRC_TRANS, nullptr, millis(), "%u log messages dropped (queue full)", args);
+    }
+
+    if (uartThrottled > 0) {
+      xSemaphoreTake(logMutex, portMAX_DELAY);
+      LogSinkConfig config = sinkConfig;
+      xSemaphoreGive(logMutex);
+      // The summary uses a token of its own
+      if (takeUartToken(config)) {
+        reportUartThrottling();
+      }
+    }
+
+    // Batched flash writes, right away before a reboot
+    if (journalFlushRequested.load()) {
+      journalFlush(true);
+      journalFlushRequested.store(false);
+    } else {
+      journalFlush(false);
+    }
+  }
 }
 
-void logPrintln(const String& message) {
-  Serial.println(message);
-  bufferLogText(message + "\n");
+void flushLogs() {
+  // Wait for the log task to catch up and write the journal, bounded in case it is stuck
+  unsigned long start = millis();
+  while (logTaskHandle != NULL && logQueueTail != logQueueHead.load(std::memory_order_relaxed) &&
+         millis() - start < 500) {
+    delay(1);
+  }
+  if (logTaskHandle != NULL) {
+    journalFlushRequested.store(true);
+    xTaskNotifyGive(logTaskHandle);
+    while (journalFlushRequested.load() && millis() - start < 1000) {
+      delay(1);
+    }
+  }
+  Serial.flush();
+  uart2.flush();
 }
 
-void logPrintln(int value) {
-  Serial.println(value);
-  bufferLogText(String(value) + "\n");
+void setupLogger() {
+  // Initialize USB Serial (UART0) for debugging
+  Serial.begin(115200);
+  
+  // Use the baud rate negotiated with "set-baud", if any
+  Preferences preferences;
+  if (preferences.begin(NVS_NAMESPACE, true)) {
+    uart2Baud = preferences.getUInt(NVS_BAUD_KEY, UART2_BAUD);
+    preferences.end();
+  }
+  
+  frameMutex = xSemaphoreCreateMutex();
+  logMutex = xSemaphoreCreateMutex();
+
+  // Initialize UART2 for MQTT module communication
+  uart2.setRxBufferSize(UART2_RX_BUFFER_SIZE);
+  uart2.begin(uart2Baud, SERIAL_8N1, UART2_RX_PIN, UART2_TX_PIN);
+  
+  // Wait a bit for serial ports to stabilize
+  delay(100);
+
+  // Persistent journal, written by the log task
+  setupJournal();
+
+  // Lines logged so far are waiting in the queue
+  if (xTaskCreate(logTask, "log", LOG_TASK_STACK_SIZE, NULL, LOG_TASK_PRIORITY, &logTaskHandle) != pdPASS) {
+    Serial.println("[TRANS] ERROR: Failed to start log task");
+    logTaskHandle = NULL;
+    return;
+  }
+  xTaskNotifyGive(logTaskHandle);
 }
 
-void logPrintln(unsigned int value) {
-  Serial.println(value);
-  bufferLogText(String(value) + "\n");
+void sendGatewayMessage(const JsonDocument& doc) {
+  // frameMutex serializes every UART2 write with framing and baud rate changes
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  if (getSerialFraming() == FRAMING_BINARY) {
+    // Wrap the JSON text in a FRAME_JSON frame
+    size_t jsonLen = serializeJson(doc, frameJson, sizeof(frameJson));
+    if (jsonLen >= sizeof(frameJson) - 1) {
+      xSemaphoreGive(frameMutex);
+      Serial.println("[TRANS] ERROR: Gateway message too large for binary frame");
+      return;
+    }
+    writeGatewayJson(frameJson, jsonLen);
+    xSemaphoreGive(frameMutex);
+    return;
+  }
+
+  // Single write per message – callers run in different tasks and must not
+  // interleave their lines on the link
+  String out;
+  serializeJson(doc, out);
+  out += "\r\n";
+  uart2.write((const uint8_t*)out.c_str(), out.length());
+  xSemaphoreGive(frameMutex);
 }
 
-void logPrintln(long value) {
-  Serial.println(value);
-  bufferLogText(String(value) + "\n");
+void sendGatewayData(const uint8_t* mac, const char* payload, size_t length) {
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  if (getSerialFraming() == FRAMING_BINARY) {
+    // MAC as raw bytes, payload passed through untouched
+    FrameWriter writer;
+    frameBegin(writer, frameBuffer, sizeof(frameBuffer), FRAME_DATA);
+    frameAddTlv(writer, TLV_MAC, mac, 6);
+    frameAddTlv(writer, TLV_PAYLOAD, payload, length);
+    size_t encodedLen = frameFinish(writer, frameEncoded, sizeof(frameEncoded));
+    if (encodedLen > 0) {
+      uart2.write(frameEncoded, encodedLen);
+    }
+    xSemaphoreGive(frameMutex);
+    if (encodedLen == 0) {
+      Serial.println("[TRANS] ERROR: Data message too large for binary frame");
+    }
+    return;
+  }
+  xSemaphoreGive(frameMutex);
+
+  char macStr[13];
+  sprintf(macStr, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+  JsonDocument doc;
+  doc["type"] = "data";
+  doc["mac"] = macStr;
+  doc["message"] = serialized(payload, length);
+  sendGatewayMessage(doc);
 }
 
-void logPrintln(unsigned long value) {
-  Serial.println(value);
-  bufferLogText(String(value) + "\n");
+HardwareSerial& getUART2() {
+  return uart2;
 }
 
-void logPrintln(uint8_t value, int format) {
-  Serial.println(value, format);
-  bufferLogText(String(value, format) + "\n");
+uint32_t getUART2Baud() {
+  return uart2Baud;
 }
 
-void logPrintln() {
-  Serial.println();
-  bufferLogText("\n");
+void setUART2Baud(uint32_t baud, bool persist) {
+  // Let pending output leave at the old rate first; no other task may start
+  // a message until the new rate is set
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  uart2.flush();
+  uart2.updateBaudRate(baud);
+  uart2Baud = baud;
+  xSemaphoreGive(frameMutex);
+
+  if (persist) {
+    Preferences preferences;
+    if (!preferences.begin(NVS_NAMESPACE, false)) {
+      LOG_ERROR(LOG_SRC_TRANS, "Failed to open NVS for writing");
+      return;
+    }
+    preferences.putUInt(NVS_BAUD_KEY, baud);
+    preferences.end();
+  }
 }
 
-void logPrintf(const char* format, ...) {
-  char buffer[256];
-  va_list args;
-  va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
-  va_end(args);
-  
-  Serial.print(buffer);
-  bufferLogText(buffer);
+void setUART2Framing(SerialFraming framing) {
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  uart2.flush();
+  setSerialFraming(framing);
+  xSemaphoreGive(frameMutex);
 }
 
-HardwareSerial& getUART2() {
-  return uart2;
+void resetUART2Baud() {
+  setUART2Baud(UART2_BAUD, true);
 }
 
 String getLogsJson() {
   JsonDocument doc;
   JsonArray logArray = doc.to<JsonArray>();
   
-  for (const auto& log : logBuffer) {
+  xSemaphoreTake(logMutex, portMAX_DELAY);
+  size_t pos = logHead;
+  for (size_t i = 0; i < logRecords; i++) {
+    pos = logRecordAt(pos);
+    LogRecord header;
+    memcpy(&header, logArena + pos, sizeof(header));
+
     JsonObject obj = logArray.add<JsonObject>();
-    obj["id"] = log.id;
+    obj["id"] = header.id;
     
     // Format timestamp as HH:MM:SS.mmm
-    unsigned long totalMillis = log.timestampMs;
+    unsigned long totalMillis = header.timestampMs;
     unsigned long hours = totalMillis / 3600000;
     unsigned long minutes = (totalMillis % 3600000) / 60000;
     unsigned long seconds = (totalMillis % 60000) / 1000;
@@ -239,15 +713,52 @@ String getLogsJson() {
     sprintf(timeBuf, "%02lu:%02lu:%02lu.%03lu", hours, minutes, seconds, ms);
     
     obj["timestamp"] = String(timeBuf);
-    obj["message"] = log.message;
+    obj["level"] = LOG_LEVEL_NAMES[header.level];
+    obj["message"] = (const char*)(logArena + pos + sizeof(header));
     obj["job"] = "TRANS";
+
+    pos += logRecordSize(header.length);
   }
+  xSemaphoreGive(logMutex);
   
   String response;
   serializeJson(doc, response);
   return response;
 }
 
+LogSinkConfig getLogSinkConfig() {
+  xSemaphoreTake(logMutex, portMAX_DELAY);
+  LogSinkConfig config = sinkConfig;
+  xSemaphoreGive(logMutex);
+  return config;
+}
+
+void setLogSinkConfig(const LogSinkConfig& config) {
+  xSemaphoreTake(logMutex, portMAX_DELAY);
+  sinkConfig = config;
+  xSemaphoreGive(logMutex);
+}
+
+uint32_t getUartLogDropped() {
+  return uartDroppedTotal.load(std::memory_order_relaxed);
+}
+
+const char* logLevelName(uint8_t level) {
+  return level <= LOG_LEVEL_ERROR ? LOG_LEVEL_NAMES[level] : "unknown";
+}
+
+int parseLogLevel(const char* name) {
+  for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; level++) {
+    if (name != nullptr && strcmp(name, LOG_LEVEL_NAMES[level]) == 0) {
+      return level;
+    }
+  }
+  return -1;
+}
+
 void clearLogBuffer() {
-  logBuffer.clear();
+  xSemaphoreTake(logMutex, portMAX_DELAY);
+  logHead = logTail = 0;
+  logRecords = 0;
+  xSemaphoreGive(logMutex);
 }
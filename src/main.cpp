@@ -3,12 +3,17 @@
 #include <ArduinoJson.h>
 #include "config.h"
 #include "crypto.h"
+#include "compression.h"
 #include "logger.h"
 #include "serial_handler.h"
 #include "espnow_handler.h"
 #include "wifi_web_handler.h"
 #include "led_handler.h"
 #include "button_handler.h"
+#include "peer_directory.h"
+
+// Upper bound of serial messages handled per loop() iteration
+#define SERIAL_MESSAGES_PER_LOOP 4
 
 // Software watchdog
 unsigned long lastLoopTime = 0;
@@ -29,12 +34,18 @@ void setup() {
   // Initialize LED handler
   setupLed();
   
-  // Initialize crypto
+  // Initialize crypto and payload compression
   setupCrypto();
+  setupCompression();
   
   // Initialize serial communication
   setupSerial();
   
+  // Initialize the peer directory and load named peer groups used as "to" targets
+  setupPeerDirectory();
+  loadPeerDirectory();
+  loadPeerGroups();
+  
   // Initialize Wi-Fi & Web Server Mode (switches to ESP-NOW after timeout/command)
   setupWifiWeb();
 
@@ -51,10 +62,9 @@ void loop() {
   
   // Software watchdog - check if loop is running
   if (currentMillis - lastLoopTime > WATCHDOG_TIMEOUT_S * 1000UL) {
-    logPrintln("[TRANS] ERROR: Watchdog timeout - system appears hung");
-    logPrintln("[TRANS] Rebooting...");
-    Serial.flush();
-    getUART2().flush();
+    LOG_ERROR(LOG_SRC_TRANS, "Watchdog timeout - system appears hung");
+    LOG_INFO(LOG_SRC_TRANS, "Rebooting...");
+    flushLogs();
     delay(100);
     ESP.restart();
   }
@@ -69,6 +79,9 @@ void loop() {
   // Update non-blocking LED pattern generator
   updateLed();
   
+  // Persist peer directory changes (deferred NVS write)
+  handlePeerDirectory();
+  
   // Send heartbeat message
   if (currentMillis - lastHeartbeatMillis >= HEART_BEAT_S * 1000UL) {
     lastHeartbeatMillis = currentMillis;
@@ -87,11 +100,17 @@ void loop() {
     sendGatewayMessage(hb);
   }
   
-  // Handle incoming serial messages
-  if (readSerialMessage()) {
+  // Handle incoming serial messages (a few per iteration so bursts drain quickly)
+  for (int i = 0; i < SERIAL_MESSAGES_PER_LOOP && readSerialMessage(); i++) {
     handleSerialMessage();
   }
   
+  // Send coalesced messages whose window has passed
+  handleEspNowBatches();
+  
+  // Precompute AES keystream for upcoming frames with the spare time
+  handleCrypto();
+  
   // Small yield to prevent watchdog issues
   yield();
 }
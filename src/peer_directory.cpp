@@ -0,0 +1,796 @@
+#include "peer_directory.h"
+#include "config.h"
+#include "logger.h"
+#include <esp_now.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <Preferences.h>
+
+// Number of devices the directory can hold (can be overridden in config.h)
+#ifndef PEER_DIRECTORY_SIZE
+#define PEER_DIRECTORY_SIZE 64
+#endif
+
+// Default retransmission policy for peers without their own (see set-retry)
+#ifndef TX_RETRY_MAX_ATTEMPTS
+#define TX_RETRY_MAX_ATTEMPTS 3
+#endif
+#ifndef TX_RETRY_BACKOFF_MS
+#define TX_RETRY_BACKOFF_MS 20
+#endif
+#ifndef TX_RETRY_BACKOFF_MAX_MS
+#define TX_RETRY_BACKOFF_MAX_MS 200
+#endif
+
+// Replay floors of known peers are reserved in NVS this many counters ahead,
+// like the transmit counter (can be overridden in config.h)
+#ifndef PEER_RX_COUNTER_BLOCK
+#define PEER_RX_COUNTER_BLOCK 256
+#endif
+
+// Senders outside the directory whose replay window is tracked in RAM only
+#ifndef PEER_RX_UNKNOWN_SLOTS
+#define PEER_RX_UNKNOWN_SLOTS 8
+#endif
+
+#define NVS_NAMESPACE "espnow_gw"
+#define NVS_PEERS_KEY "peers"
+#define NVS_RX_FLOOR_PREFIX "rx"  // + 12 hex digits of the MAC, one key per peer
+#define PEER_RECORD_VERSION 5
+#define PEER_PERSIST_DELAY_MS 5000  // Coalesce directory changes into one NVS write
+
+#define PEER_DRIVER_SLOTS ESP_NOW_MAX_TOTAL_PEER_NUM
+#define PEER_HASH_BUCKETS ((PEER_DIRECTORY_SIZE + 1) * 2)  // Keeps the load factor at or below 0.5
+#define NO_PEER -1
+
+struct PeerEntry {
+  uint8_t mac[6];
+  uint8_t channel;    // Wi-Fi channel, 0 = current channel
+  RetryPolicy retry;
+  bool customRetry;   // false = follows the default policy
+  PeerCrypto crypto;  // Encryption mode and key slot
+  bool compress;      // Payloads are compressed (see compression.h)
+  uint16_t frameMax;  // Largest frame the peer accepts, 0 = unknown (v1 limit)
+  uint8_t coalesceMs; // Coalescing window for outgoing messages, 0 = off
+  bool registered;    // Holds an ESP-NOW driver slot
+  int16_t lruPrev;    // Neighbours in the LRU list of registered peers
+  int16_t lruNext;
+  bool rxSeen;        // Replay window below is valid
+  uint64_t rxCounter; // Highest authenticated frame counter received from the peer
+  uint64_t rxWindow;  // Bit n set = rxCounter - n already received
+  bool rxLoaded;      // rxReserved was read from NVS
+  uint64_t rxReserved; // Counters below this are covered by the floor stored in NVS
+};
+
+// Replay window of an authenticated sender that is not in the directory
+struct UnknownSender {
+  bool used;
+  uint8_t mac[6];
+  uint64_t rxCounter;
+  uint64_t rxWindow;
+  unsigned long lastMs;
+};
+
+// One extra entry for the broadcast address, which needs a driver slot like
+// any peer but is neither persisted nor counted as a device
+static PeerEntry peers[PEER_DIRECTORY_SIZE + 1];
+static uint16_t peerCount = 0;
+static bool broadcastListed = false;  // The broadcast address holds an entry
+
+// MAC -> index into peers[], open addressing with linear probing
+static int16_t hashIndex[PEER_HASH_BUCKETS];
+
+// Registered peers, most recently used first
+static int16_t lruHead = NO_PEER;
+static int16_t lruTail = NO_PEER;
+static uint8_t registeredCount = 0;
+
+static UnknownSender unknownSenders[PEER_RX_UNKNOWN_SLOTS];
+
+static RetryPolicy defaultRetryPolicy = { TX_RETRY_MAX_ATTEMPTS, TX_RETRY_BACKOFF_MS, TX_RETRY_BACKOFF_MAX_MS };
+
+static SemaphoreHandle_t directoryMutex = NULL;
+
+// Deferred persistence – NVS is written from loop(), never from the send path
+static Preferences preferences;
+static bool directoryDirty = false;
+static unsigned long lastChangeMs = 0;
+
+// NVS record layout (append new fields at the end and bump PEER_RECORD_VERSION)
+struct PersistedPeerHeader {
+  uint8_t version;
+  uint8_t recordSize;
+  uint16_t count;
+};
+
+struct PersistedPeer {
+  uint8_t mac[6];
+  uint8_t channel;
+  uint8_t customRetry;
+  RetryPolicy retry;
+  PeerCrypto crypto;  // Added in version 2
+  uint8_t compress;   // Added in version 3
+  uint16_t frameMax;  // Added in version 4
+  uint8_t coalesceMs; // Added in version 5
+};
+
+static uint8_t persistBuffer[sizeof(PersistedPeerHeader) + PEER_DIRECTORY_SIZE * sizeof(PersistedPeer)];
+
+static void lockDirectory() {
+  xSemaphoreTake(directoryMutex, portMAX_DELAY);
+}
+
+static void unlockDirectory() {
+  xSemaphoreGive(directoryMutex);
+}
+
+static void markDirty() {
+  directoryDirty = true;
+  lastChangeMs = millis();
+}
+
+// ---------------------------------------------------------------------------
+// Hash index
+// ---------------------------------------------------------------------------
+
+// FNV-1a over the 6 MAC bytes
+static uint32_t hashMac(const uint8_t* mac) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 6; i++) {
+    hash ^= mac[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static int16_t findPeerIndex(const uint8_t* mac) {
+  uint32_t bucket = hashMac(mac) % PEER_HASH_BUCKETS;
+  for (int probe = 0; probe < PEER_HASH_BUCKETS; probe++) {
+    int16_t index = hashIndex[bucket];
+    if (index == NO_PEER) {
+      return NO_PEER;
+    }
+    if (memcmp(peers[index].mac, mac, 6) == 0) {
+      return index;
+    }
+    bucket = (bucket + 1) % PEER_HASH_BUCKETS;
+  }
+  return NO_PEER;
+}
+
+static bool isBroadcastMac(const uint8_t* mac) {
+  static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  return memcmp(mac, broadcast, 6) == 0;
+}
+
+static int16_t insertPeer(const uint8_t* mac) {
+  bool broadcast = isBroadcastMac(mac);
+  if (!broadcast && peerCount - (broadcastListed ? 1 : 0) >= PEER_DIRECTORY_SIZE) {
+    LOG_ERROR(LOG_SRC_TRANS, "Peer directory full (max %d peers)", PEER_DIRECTORY_SIZE);
+    return NO_PEER;
+  }
+
+  int16_t index = peerCount++;
+  PeerEntry& entry = peers[index];
+  memcpy(entry.mac, mac, 6);
+  entry.channel = 0;
+  entry.retry = defaultRetryPolicy;
+  entry.customRetry = false;
+  entry.crypto = { 0, 0 };
+  entry.compress = false;
+  entry.frameMax = 0;
+  entry.coalesceMs = 0;
+  entry.registered = false;
+  entry.lruPrev = NO_PEER;
+  entry.lruNext = NO_PEER;
+  entry.rxSeen = false;
+  entry.rxCounter = 0;
+  entry.rxWindow = 0;
+  entry.rxLoaded = false;
+  entry.rxReserved = 0;
+
+  // Keep the replay window of a sender that was tracked outside the directory
+  for (int i = 0; i < PEER_RX_UNKNOWN_SLOTS; i++) {
+    UnknownSender& sender = unknownSenders[i];
+    if (sender.used && memcmp(sender.mac, mac, 6) == 0) {
+      entry.rxSeen = true;
+      entry.rxCounter = sender.rxCounter;
+      entry.rxWindow = sender.rxWindow;
+      sender.used = false;
+    }
+  }
+
+  uint32_t bucket = hashMac(mac) % PEER_HASH_BUCKETS;
+  while (hashIndex[bucket] != NO_PEER) {
+    bucket = (bucket + 1) % PEER_HASH_BUCKETS;
+  }
+  hashIndex[bucket] = index;
+
+  if (broadcast) {
+    broadcastListed = true;
+  } else {
+    markDirty();
+  }
+  return index;
+}
+
+// Rebuild the hash index after entries were moved (peer removal)
+static void rebuildHashIndex() {
+  for (int i = 0; i < PEER_HASH_BUCKETS; i++) {
+    hashIndex[i] = NO_PEER;
+  }
+  for (int16_t index = 0; index < peerCount; index++) {
+    uint32_t bucket = hashMac(peers[index].mac) % PEER_HASH_BUCKETS;
+    while (hashIndex[bucket] != NO_PEER) {
+      bucket = (bucket + 1) % PEER_HASH_BUCKETS;
+    }
+    hashIndex[bucket] = index;
+  }
+}
+
+// Lookup for commands and the send path – logs peers that are actually new
+static int16_t findOrInsertPeer(const uint8_t* mac) {
+  int16_t index = findPeerIndex(mac);
+  if (index != NO_PEER) {
+    return index;
+  }
+  index = insertPeer(mac);
+  if (index != NO_PEER && !isBroadcastMac(mac)) {
+    LOG_PEER_INFO(mac, "New peer added");
+  }
+  return index;
+}
+
+// ---------------------------------------------------------------------------
+// LRU list of driver registrations
+// ---------------------------------------------------------------------------
+
+static void lruUnlink(int16_t index) {
+  PeerEntry& entry = peers[index];
+  if (entry.lruPrev != NO_PEER) {
+    peers[entry.lruPrev].lruNext = entry.lruNext;
+  } else {
+    lruHead = entry.lruNext;
+  }
+  if (entry.lruNext != NO_PEER) {
+    peers[entry.lruNext].lruPrev = entry.lruPrev;
+  } else {
+    lruTail = entry.lruPrev;
+  }
+  entry.lruPrev = NO_PEER;
+  entry.lruNext = NO_PEER;
+}
+
+static void lruPushFront(int16_t index) {
+  PeerEntry& entry = peers[index];
+  entry.lruPrev = NO_PEER;
+  entry.lruNext = lruHead;
+  if (lruHead != NO_PEER) {
+    peers[lruHead].lruPrev = index;
+  }
+  lruHead = index;
+  if (lruTail == NO_PEER) {
+    lruTail = index;
+  }
+}
+
+// Free the driver slot of the least recently used peer
+static void evictLeastRecentlyUsed() {
+  int16_t victim = lruTail;
+  if (victim == NO_PEER) {
+    return;
+  }
+  esp_now_del_peer(peers[victim].mac);
+  lruUnlink(victim);
+  peers[victim].registered = false;
+  registeredCount--;
+}
+
+// ---------------------------------------------------------------------------
+
+void setupPeerDirectory() {
+  for (int i = 0; i < PEER_HASH_BUCKETS; i++) {
+    hashIndex[i] = NO_PEER;
+  }
+  directoryMutex = xSemaphoreCreateMutex();
+}
+
+bool addPeer(const uint8_t* macAddress, RetryPolicy* retry) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER && retry != nullptr) {
+    *retry = peers[index].retry;
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+bool ensurePeerRegistered(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index == NO_PEER) {
+    unlockDirectory();
+    return false;
+  }
+
+  PeerEntry& entry = peers[index];
+  if (entry.registered) {
+    // Cache hit – just refresh the LRU position
+    if (lruHead != index) {
+      lruUnlink(index);
+      lruPushFront(index);
+    }
+    unlockDirectory();
+    return true;
+  }
+
+  if (registeredCount >= PEER_DRIVER_SLOTS) {
+    evictLeastRecentlyUsed();
+  }
+
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, macAddress, 6);
+  peerInfo.channel = entry.channel;
+  peerInfo.encrypt = false;
+
+  esp_err_t addPeerResult = esp_now_add_peer(&peerInfo);
+  if (addPeerResult == ESP_ERR_ESPNOW_FULL && lruTail != NO_PEER) {
+    // Someone else holds driver slots – make room and try once more
+    evictLeastRecentlyUsed();
+    addPeerResult = esp_now_add_peer(&peerInfo);
+  }
+  if (addPeerResult == ESP_ERR_ESPNOW_EXIST) {
+    addPeerResult = ESP_OK;
+  }
+  if (addPeerResult != ESP_OK) {
+    unlockDirectory();
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to add peer, code: %d", addPeerResult);
+    return false;
+  }
+
+  entry.registered = true;
+  registeredCount++;
+  lruPushFront(index);
+  unlockDirectory();
+  return true;
+}
+
+void resetPeerRegistrations() {
+  lockDirectory();
+  for (int i = 0; i < peerCount; i++) {
+    peers[i].registered = false;
+    peers[i].lruPrev = NO_PEER;
+    peers[i].lruNext = NO_PEER;
+  }
+  lruHead = NO_PEER;
+  lruTail = NO_PEER;
+  registeredCount = 0;
+  unlockDirectory();
+}
+
+bool setRetryPolicy(const uint8_t* macAddress, const RetryPolicy& policy) {
+  lockDirectory();
+  if (macAddress == nullptr) {
+    defaultRetryPolicy = policy;
+    // Peers without a policy of their own follow the new default
+    for (int i = 0; i < peerCount; i++) {
+      if (!peers[i].customRetry) {
+        peers[i].retry = policy;
+      }
+    }
+    unlockDirectory();
+    return true;
+  }
+
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER) {
+    peers[index].retry = policy;
+    peers[index].customRetry = true;
+    markDirty();
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+RetryPolicy getRetryPolicy(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = macAddress != nullptr ? findPeerIndex(macAddress) : NO_PEER;
+  RetryPolicy policy = index != NO_PEER ? peers[index].retry : defaultRetryPolicy;
+  unlockDirectory();
+  return policy;
+}
+
+bool setPeerChannel(const uint8_t* macAddress, uint8_t channel) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER && peers[index].channel != channel) {
+    peers[index].channel = channel;
+    markDirty();
+    // Re-register with the new channel on next use
+    if (peers[index].registered) {
+      esp_now_del_peer(peers[index].mac);
+      lruUnlink(index);
+      peers[index].registered = false;
+      registeredCount--;
+    }
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+bool setPeerCrypto(const uint8_t* macAddress, const PeerCrypto& crypto) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER) {
+    peers[index].crypto = crypto;
+    markDirty();
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+PeerCrypto getPeerCrypto(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findPeerIndex(macAddress);
+  PeerCrypto crypto = index != NO_PEER ? peers[index].crypto : PeerCrypto{ 0, 0 };
+  unlockDirectory();
+  return crypto;
+}
+
+bool setPeerCompression(const uint8_t* macAddress, bool enabled) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER && peers[index].compress != enabled) {
+    peers[index].compress = enabled;
+    markDirty();
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+bool getPeerCompression(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findPeerIndex(macAddress);
+  bool enabled = index != NO_PEER && peers[index].compress;
+  unlockDirectory();
+  return enabled;
+}
+
+bool setPeerFrameMax(const uint8_t* macAddress, uint16_t frameMax) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER && peers[index].frameMax != frameMax) {
+    peers[index].frameMax = frameMax;
+    markDirty();
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+uint16_t getPeerFrameMax(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findPeerIndex(macAddress);
+  uint16_t frameMax = index != NO_PEER ? peers[index].frameMax : 0;
+  unlockDirectory();
+  if (frameMax == 0) {
+    return ESPNOW_V1_FRAME_MAX;
+  }
+  return frameMax < ESPNOW_FRAME_MAX ? frameMax : ESPNOW_FRAME_MAX;
+}
+
+bool setPeerCoalescing(const uint8_t* macAddress, uint8_t windowMs) {
+  lockDirectory();
+  int16_t index = findOrInsertPeer(macAddress);
+  if (index != NO_PEER && peers[index].coalesceMs != windowMs) {
+    peers[index].coalesceMs = windowMs;
+    markDirty();
+  }
+  unlockDirectory();
+  return index != NO_PEER;
+}
+
+uint8_t getPeerCoalescing(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findPeerIndex(macAddress);
+  uint8_t windowMs = index != NO_PEER ? peers[index].coalesceMs : 0;
+  unlockDirectory();
+  return windowMs;
+}
+
+bool getPeerFramedFormats(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findPeerIndex(macAddress);
+  bool framed = false;
+  if (index != NO_PEER) {
+    const PeerEntry& entry = peers[index];
+    framed = entry.frameMax > ESPNOW_V1_FRAME_MAX || entry.compress || entry.coalesceMs > 0;
+  }
+  unlockDirectory();
+  return framed;
+}
+
+bool removePeer(const uint8_t* macAddress) {
+  lockDirectory();
+  int16_t index = findPeerIndex(macAddress);
+  if (index == NO_PEER) {
+    unlockDirectory();
+    return false;
+  }
+
+  if (peers[index].registered) {
+    esp_now_del_peer(peers[index].mac);
+    lruUnlink(index);
+    registeredCount--;
+  }
+
+  // Move the last entry into the gap, fixing up its LRU neighbours
+  int16_t last = peerCount - 1;
+  if (index != last) {
+    peers[index] = peers[last];
+    if (peers[index].registered) {
+      if (peers[index].lruPrev != NO_PEER) peers[peers[index].lruPrev].lruNext = index;
+      else lruHead = index;
+      if (peers[index].lruNext != NO_PEER) peers[peers[index].lruNext].lruPrev = index;
+      else lruTail = index;
+    }
+  }
+  peerCount--;
+  if (isBroadcastMac(macAddress)) {
+    broadcastListed = false;
+  }
+  rebuildHashIndex();
+  markDirty();
+  unlockDirectory();
+  return true;
+}
+
+// Accept counter once against a sender's replay window, updating the window
+static bool acceptCounter(bool& seen, uint64_t& highest, uint64_t& window, uint64_t counter) {
+  if (!seen || counter > highest) {
+    // Newest frame so far – slide the window forward
+    uint64_t shift = counter - highest;
+    window = (!seen || shift >= 64) ? 1 : (window << shift) | 1;
+    highest = counter;
+    seen = true;
+    return true;
+  }
+  // Older frame – accept once if it is still inside the window
+  uint64_t age = highest - counter;
+  uint64_t bit = age < 64 ? 1ULL << age : 0;
+  bool accepted = bit != 0 && (window & bit) == 0;
+  window |= bit;
+  return accepted;
+}
+
+// Replay window for a sender outside the directory; the least recently heard
+// one is forgotten when all slots are taken
+static UnknownSender& findUnknownSender(const uint8_t* mac, bool& isNew) {
+  UnknownSender* oldest = &unknownSenders[0];
+  for (int i = 0; i < PEER_RX_UNKNOWN_SLOTS; i++) {
+    UnknownSender& sender = unknownSenders[i];
+    if (sender.used && memcmp(sender.mac, mac, 6) == 0) {
+      isNew = false;
+      return sender;
+    }
+    if (!sender.used || (oldest->used && (long)(sender.lastMs - oldest->lastMs) < 0)) {
+      oldest = &sender;
+    }
+  }
+  isNew = true;
+  oldest->used = true;
+  memcpy(oldest->mac, mac, 6);
+  return *oldest;
+}
+
+static void rxFloorKey(const uint8_t* mac, char* key) {
+  sprintf(key, NVS_RX_FLOOR_PREFIX "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+// Everything below the floor stored for a peer counts as received (once per boot)
+static void loadRxFloor(PeerEntry& entry) {
+  entry.rxLoaded = true;
+  char key[16];
+  rxFloorKey(entry.mac, key);
+  Preferences floorPreferences;  // The shared instance belongs to loop()
+  if (!floorPreferences.begin(NVS_NAMESPACE, true)) {
+    return;
+  }
+  uint64_t floor = floorPreferences.getULong64(key, 0);
+  floorPreferences.end();
+
+  entry.rxReserved = floor;
+  if (floor > 0 && (!entry.rxSeen || floor - 1 > entry.rxCounter)) {
+    entry.rxSeen = true;
+    entry.rxCounter = floor - 1;
+    entry.rxWindow = ~0ULL;
+  }
+}
+
+// Store a new floor PEER_RX_COUNTER_BLOCK counters ahead of counter
+static bool reserveRxFloor(PeerEntry& entry, uint64_t counter) {
+  char key[16];
+  rxFloorKey(entry.mac, key);
+  Preferences floorPreferences;
+  if (!floorPreferences.begin(NVS_NAMESPACE, false)) {
+    return false;
+  }
+  uint64_t reserved = counter + PEER_RX_COUNTER_BLOCK;
+  bool ok = floorPreferences.putULong64(key, reserved) == sizeof(uint64_t);
+  floorPreferences.end();
+  if (ok) {
+    entry.rxReserved = reserved;
+  }
+  return ok;
+}
+
+bool acceptPeerCounter(const uint8_t* macAddress, uint64_t counter) {
+  lockDirectory();
+  // Receiving a frame does not add the sender to the directory
+  int16_t index = findPeerIndex(macAddress);
+  bool accepted;
+  if (index != NO_PEER) {
+    PeerEntry& entry = peers[index];
+    if (!entry.rxLoaded) {
+      loadRxFloor(entry);
+    }
+    // Never accept a counter the stored floor does not cover (one NVS write
+    // per PEER_RX_COUNTER_BLOCK frames of a peer)
+    if (counter >= entry.rxReserved && !reserveRxFloor(entry, counter)) {
+      unlockDirectory();
+      LOG_PEER_ERROR(macAddress, "Cannot reserve replay floor in NVS");
+      return false;
+    }
+    accepted = acceptCounter(entry.rxSeen, entry.rxCounter, entry.rxWindow, counter);
+  } else {
+    bool isNew;
+    UnknownSender& sender = findUnknownSender(macAddress, isNew);
+    bool seen = !isNew;
+    accepted = acceptCounter(seen, sender.rxCounter, sender.rxWindow, counter);
+    sender.lastMs = millis();
+  }
+  unlockDirectory();
+  return accepted;
+}
+
+uint16_t getPeerDirectoryCount() {
+  return peerCount - (broadcastListed ? 1 : 0);
+}
+
+// ---------------------------------------------------------------------------
+// Persistence
+// ---------------------------------------------------------------------------
+
+void loadPeerDirectory() {
+  if (!preferences.begin(NVS_NAMESPACE, true)) {
+    return;
+  }
+
+  size_t len = preferences.getBytesLength(NVS_PEERS_KEY);
+  if (len < sizeof(PersistedPeerHeader) || len > sizeof(persistBuffer)) {
+    preferences.end();
+    return;
+  }
+  preferences.getBytes(NVS_PEERS_KEY, persistBuffer, len);
+  preferences.end();
+
+  // Records of older versions are a prefix of the current one, the fields
+  // they lack are left zero (default behaviour)
+  PersistedPeerHeader header;
+  memcpy(&header, persistBuffer, sizeof(header));
+  if (header.version == 0 || header.version > PEER_RECORD_VERSION ||
+      header.recordSize == 0 || header.recordSize > sizeof(PersistedPeer) ||
+      sizeof(header) + header.count * header.recordSize != len) {
+    LOG_WARN(LOG_SRC_TRANS, "Ignoring peer directory in NVS with unknown layout");
+    return;
+  }
+
+  lockDirectory();
+  for (int i = 0; i < header.count && getPeerDirectoryCount() < PEER_DIRECTORY_SIZE; i++) {
+    PersistedPeer record = {};
+    memcpy(&record, persistBuffer + sizeof(header) + i * header.recordSize, header.recordSize);
+    if (isBroadcastMac(record.mac)) {
+      continue;  // Stored by older firmware
+    }
+    int16_t index = findPeerIndex(record.mac);
+    if (index == NO_PEER) {
+      index = insertPeer(record.mac);
+    }
+    if (index == NO_PEER) {
+      break;
+    }
+    peers[index].channel = record.channel;
+    peers[index].customRetry = record.customRetry != 0;
+    if (peers[index].customRetry) {
+      peers[index].retry = record.retry;
+    }
+    peers[index].crypto = record.crypto;
+    peers[index].compress = record.compress != 0;
+    peers[index].frameMax = record.frameMax;
+    peers[index].coalesceMs = record.coalesceMs;
+  }
+  // Loading itself is not a change worth writing back
+  directoryDirty = false;
+  unlockDirectory();
+
+  LOG_INFO(LOG_SRC_TRANS, "Loaded %u peers from NVS", getPeerDirectoryCount());
+}
+
+// Serialize the directory, most recently used registrations first so the
+// next warm-load registers the busiest peers
+static size_t serializeDirectory() {
+  PersistedPeerHeader header = { PEER_RECORD_VERSION, sizeof(PersistedPeer), 0 };
+  uint8_t* out = persistBuffer + sizeof(header);
+
+  auto append = [&](const PeerEntry& entry) {
+    if (isBroadcastMac(entry.mac)) {
+      return;
+    }
+    PersistedPeer record = {};
+    memcpy(record.mac, entry.mac, 6);
+    record.channel = entry.channel;
+    record.customRetry = entry.customRetry ? 1 : 0;
+    record.retry = entry.retry;
+    record.crypto = entry.crypto;
+    record.compress = entry.compress ? 1 : 0;
+    record.frameMax = entry.frameMax;
+    record.coalesceMs = entry.coalesceMs;
+    memcpy(out + header.count * sizeof(PersistedPeer), &record, sizeof(record));
+    header.count++;
+  };
+
+  for (int16_t index = lruHead; index != NO_PEER; index = peers[index].lruNext) {
+    append(peers[index]);
+  }
+  for (int16_t index = 0; index < peerCount; index++) {
+    if (!peers[index].registered) {
+      append(peers[index]);
+    }
+  }
+
+  memcpy(persistBuffer, &header, sizeof(header));
+  return sizeof(header) + header.count * sizeof(PersistedPeer);
+}
+
+void handlePeerDirectory() {
+  if (!directoryDirty || millis() - lastChangeMs < PEER_PERSIST_DELAY_MS) {
+    return;
+  }
+
+  lockDirectory();
+  size_t len = serializeDirectory();
+  directoryDirty = false;
+  unlockDirectory();
+
+  if (!preferences.begin(NVS_NAMESPACE, false)) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to open NVS for writing");
+    return;
+  }
+  size_t written = preferences.putBytes(NVS_PEERS_KEY, persistBuffer, len);
+  preferences.end();
+
+  if (written != len) {
+    LOG_ERROR(LOG_SRC_TRANS, "Failed to write peer directory to NVS");
+  }
+}
+
+void registerKnownPeers() {
+  // Register in reverse so the first (most recently used) peer ends up at the LRU head
+  int count = peerCount < PEER_DRIVER_SLOTS ? peerCount : PEER_DRIVER_SLOTS;
+  uint8_t macs[PEER_DRIVER_SLOTS][6];
+
+  lockDirectory();
+  for (int i = 0; i < count; i++) {
+    memcpy(macs[i], peers[i].mac, 6);
+  }
+  unlockDirectory();
+
+  int registered = 0;
+  for (int i = count - 1; i >= 0; i--) {
+    if (ensurePeerRegistered(macs[i])) {
+      registered++;
+    }
+  }
+  if (registered > 0) {
+    LOG_INFO(LOG_SRC_TRANS, "Pre-registered %d known peers", registered);
+  }
+}
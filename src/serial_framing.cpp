@@ -0,0 +1,148 @@
+#include "serial_framing.h"
+
+static SerialFraming currentFraming = FRAMING_JSON;
+
+SerialFraming getSerialFraming() {
+  return currentFraming;
+}
+
+void setSerialFraming(SerialFraming framing) {
+  currentFraming = framing;
+}
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+static uint16_t crc16(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Consistent Overhead Byte Stuffing – out must hold FRAME_ENCODED_SIZE(length) - 1 bytes
+static size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out) {
+  size_t write = 1;
+  size_t codeIndex = 0;
+  uint8_t code = 1;
+
+  for (size_t read = 0; read < length; read++) {
+    if (in[read] == 0) {
+      out[codeIndex] = code;
+      code = 1;
+      codeIndex = write++;
+    } else {
+      out[write++] = in[read];
+      code++;
+      if (code == 0xFF) {
+        out[codeIndex] = code;
+        code = 1;
+        codeIndex = write++;
+      }
+    }
+  }
+  out[codeIndex] = code;
+  return write;
+}
+
+void frameBegin(FrameWriter& writer, uint8_t* buffer, size_t capacity, uint8_t type) {
+  writer.buffer = buffer;
+  writer.capacity = capacity;
+  writer.length = 0;
+  writer.overflow = capacity < 1;
+  if (!writer.overflow) {
+    buffer[writer.length++] = type;
+  }
+}
+
+void frameAddTlv(FrameWriter& writer, uint8_t tag, const void* value, size_t length) {
+  size_t header = length < 0x80 ? 2 : 3;
+  if (writer.overflow || length > 0x7FFF || writer.length + header + length > writer.capacity) {
+    writer.overflow = true;
+    return;
+  }
+
+  uint8_t* out = writer.buffer + writer.length;
+  *out++ = tag;
+  if (length < 0x80) {
+    *out++ = length;
+  } else {
+    *out++ = 0x80 | (length >> 8);
+    *out++ = length & 0xFF;
+  }
+  memcpy(out, value, length);
+  writer.length += header + length;
+}
+
+size_t frameFinish(FrameWriter& writer, uint8_t* out, size_t outCapacity) {
+  if (writer.overflow || writer.length + 2 > writer.capacity) {
+    return 0;
+  }
+
+  uint16_t crc = crc16(writer.buffer, writer.length);
+  writer.buffer[writer.length++] = crc >> 8;
+  writer.buffer[writer.length++] = crc & 0xFF;
+
+  if (FRAME_ENCODED_SIZE(writer.length) > outCapacity) {
+    return 0;
+  }
+  size_t encoded = cobsEncode(writer.buffer, writer.length, out);
+  out[encoded++] = 0x00;
+  return encoded;
+}
+
+int frameDecode(uint8_t* buffer, size_t length) {
+  // COBS decode in place – the write position never overtakes the read position
+  size_t read = 0;
+  size_t write = 0;
+  while (read < length) {
+    uint8_t code = buffer[read++];
+    if (code == 0) {
+      return -1;
+    }
+    for (uint8_t i = 1; i < code; i++) {
+      if (read >= length) {
+        return -1;
+      }
+      buffer[write++] = buffer[read++];
+    }
+    if (code != 0xFF && read < length) {
+      buffer[write++] = 0;
+    }
+  }
+
+  // type + CRC at minimum
+  if (write < 3) {
+    return -1;
+  }
+  uint16_t expected = ((uint16_t)buffer[write - 2] << 8) | buffer[write - 1];
+  if (crc16(buffer, write - 2) != expected) {
+    return -1;
+  }
+  return write - 2;
+}
+
+bool frameNextTlv(const uint8_t* frame, size_t frameLength, size_t& offset,
+                  uint8_t& tag, const uint8_t*& value, size_t& valueLength) {
+  if (offset + 2 > frameLength) {
+    return false;
+  }
+
+  tag = frame[offset++];
+  valueLength = frame[offset++];
+  if (valueLength & 0x80) {
+    if (offset >= frameLength) {
+      return false;
+    }
+    valueLength = ((valueLength & 0x7F) << 8) | frame[offset++];
+  }
+  if (offset + valueLength > frameLength) {
+    return false;
+  }
+
+  value = frame + offset;
+  offset += valueLength;
+  return true;
+}
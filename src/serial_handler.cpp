@@ -3,62 +3,457 @@
 #include "config.h"
 #include "logger.h"
 #include "wifi_web_handler.h"
+#include "serial_framing.h"
+#include "crypto.h"
+#include "journal.h"
 #include <WiFi.h>
+#include <atomic>
 
-#define SERIAL_BUFFER_SIZE 500
+// Largest line / encoded frame accepted from the gateway
+#define SERIAL_LINE_MAX_SIZE FRAME_ENCODED_SIZE(FRAME_MAX_SIZE)
 
-// Serial message buffer
-static char serialMessageBuffer[SERIAL_BUFFER_SIZE];
+// Complete lines buffered between the UART receive callback and loop()
+#ifndef SERIAL_LINE_SLOTS
+#define SERIAL_LINE_SLOTS 8
+#endif
+
+#ifndef UART2_BAUD_CONFIRM_MS
+#define UART2_BAUD_CONFIRM_MS 3000
+#endif
+
+// Journal entries per "get-journal" response (lines are up to 256 characters)
+#define JOURNAL_SERIAL_ENTRIES 5
+
+// Baud rates accepted by "set-baud"
+static const uint32_t SUPPORTED_BAUD_RATES[] = {
+  9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1000000, 2000000
+};
+
+// ----------------------------------------------------------------
+// Line reception
+//
+// The UART driver's event task calls onUart2Receive() whenever bytes arrive.
+// It appends them to the slot at the head of a single-producer/single-consumer
+// ring and publishes the slot once the delimiter ('\n' for JSON, 0x00 for
+// binary frames) is seen, so loop() only ever handles complete lines and never
+// waits for the rest of one.
+// ----------------------------------------------------------------
+
+struct SerialLine {
+  uint16_t len;
+  uint8_t data[SERIAL_LINE_MAX_SIZE];
+};
+
+static SerialLine lineRing[SERIAL_LINE_SLOTS];
+static std::atomic<uint32_t> lineHead(0);        // advanced by the UART event task only
+static std::atomic<uint32_t> lineTail(0);        // advanced by loop() only
+static std::atomic<uint32_t> linesDropped(0);    // lines lost because the ring was full or they were too long
+static bool lineHeld = false;                    // loop() still uses the slot at lineTail
+
+// Receive accumulator state (UART event task only)
+static uint16_t accumulatedLen = 0;
+static bool discardingLine = false;
+static SerialFraming accumulatorFraming = FRAMING_JSON;
 
 // JSON document for parsed messages
 static JsonDocument doc;
 
+// Members kept when a send message is parsed; "message" itself is never
+// deserialized but passed through as a span of the received line
+static JsonDocument envelopeFilter;
+static const char* messageSpan = nullptr;
+static size_t messageSpanLength = 0;
+
+// A FRAME_SEND frame carries its payload as raw bytes instead of a JSON document
+static bool binarySendPending = false;
+static uint8_t binaryTargets[ESPNOW_MAX_TARGETS][6];
+static int binaryTargetCount = 0;
+static const char* binaryGroup = nullptr;
+static const char* binaryPayload = nullptr;
+static size_t binaryPayloadLength = 0;
+static char binaryId[ESPNOW_ID_MAX_LEN];
+
+// Baud rate switched by "set-baud" but not yet confirmed by gateway traffic
+static uint32_t pendingBaud = 0;
+static unsigned long pendingBaudSinceMs = 0;
+
+// Runs in the UART driver's event task
+static void onUart2Receive() {
+  HardwareSerial& uart = getUART2();
+
+  // Start over when the framing changed in the middle of a line
+  SerialFraming framing = getSerialFraming();
+  if (framing != accumulatorFraming) {
+    accumulatorFraming = framing;
+    accumulatedLen = 0;
+    discardingLine = false;
+  }
+  uint8_t delimiter = framing == FRAMING_BINARY ? 0x00 : '\n';
+
+  uint8_t chunk[64];
+  size_t count;
+  while ((count = uart.read(chunk, sizeof(chunk))) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      uint8_t c = chunk[i];
+      uint32_t head = lineHead.load(std::memory_order_relaxed);
+
+      if (c == delimiter) {
+        if (discardingLine) {
+          discardingLine = false;
+        } else if (accumulatedLen > 0) {
+          lineRing[head % SERIAL_LINE_SLOTS].len = accumulatedLen;
+          lineHead.store(head + 1, std::memory_order_release);
+        }
+        accumulatedLen = 0;
+        continue;
+      }
+      if (discardingLine || (framing == FRAMING_JSON && c == '\r')) {
+        continue;
+      }
+
+      // Wait for the next delimiter when the line does not fit or loop() is behind
+      if (accumulatedLen >= SERIAL_LINE_MAX_SIZE ||
+          head - lineTail.load(std::memory_order_acquire) >= SERIAL_LINE_SLOTS) {
+        linesDropped.fetch_add(1, std::memory_order_relaxed);
+        discardingLine = true;
+        accumulatedLen = 0;
+        continue;
+      }
+      lineRing[head % SERIAL_LINE_SLOTS].data[accumulatedLen++] = c;
+    }
+  }
+}
+
 void setupSerial() {
   // Initialize logger (sets up both USB Serial and UART2)
   setupLogger();
   
+  // Collect incoming lines in the background instead of polling UART2 from loop()
+  getUART2().onReceive(onUart2Receive);
+  
+  envelopeFilter["to"] = true;
+  envelopeFilter["id"] = true;
+  envelopeFilter["type"] = true;
+  envelopeFilter["command"] = true;
+  
+  // A stored rate has to be confirmed again, so a gateway that restarted at
+  // UART2_BAUD is not locked out
+  if (getUART2Baud() != UART2_BAUD) {
+    pendingBaud = getUART2Baud();
+    pendingBaudSinceMs = millis();
+  }
+  
   // Wait a bit for serial to stabilize
   delay(100);
   
-  logPrintln("[TRANS] Starting ESP-NOW Gateway Transmitter...");
-  logPrint("[TRANS] Device: ");
-  logPrintln(WHO_AM_I);
+  LOG_INFO(LOG_SRC_TRANS, "Starting ESP-NOW Gateway Transmitter...");
+  LOG_INFO(LOG_SRC_TRANS, "Device: %s", WHO_AM_I);
 }
 
-bool readSerialMessage() {
-  // Read from UART2 (MQTT module connection)
-  HardwareSerial& uart = getUART2();
-  
-  if (uart.available() > 0) {
-    // Clear buffer before reading to avoid leftover data
-    memset(serialMessageBuffer, 0, SERIAL_BUFFER_SIZE);
-    
-    // Read the incoming message
-    size_t bytesRead = uart.readBytesUntil('\n', serialMessageBuffer, SERIAL_BUFFER_SIZE - 1);
-    serialMessageBuffer[bytesRead] = '\0'; // Ensure null termination
-    
-    // Print to USB serial only (to prevent infinite loopback logging)
-    Serial.print("[TRANS] Message received from GW on serial: ");
-    Serial.println(serialMessageBuffer);
-    
-    // Clear previous JSON document
-    doc.clear();
-    
-    // Parse the message as JSON
-    DeserializationError error = deserializeJson(doc, serialMessageBuffer);
-    if (error) {
-      Serial.print(F("[TRANS] deserializeJson() failed: "));
-      Serial.println(error.c_str());
+// ----------------------------------------------------------------
+// Baud rate negotiation
+//
+// 1. Gateway sends {"command":"set-baud","baud":N} at the current rate
+// 2. We answer with status "pending" at the current rate and switch to N
+// 3. Gateway switches to N as soon as it sees the answer and sends any message
+// 4. The first message decoded at N confirms it: N is stored in NVS.
+//    Without one within UART2_BAUD_CONFIRM_MS both sides return to UART2_BAUD.
+// A rate loaded from NVS at boot goes through step 4 the same way.
+// ----------------------------------------------------------------
+
+// Called for every message decoded without errors
+static void confirmBaudRate() {
+  if (pendingBaud == 0) {
+    return;
+  }
+
+  setUART2Baud(pendingBaud, true);
+  LOG_INFO(LOG_SRC_TRANS, "UART2 baud rate %lu confirmed", (unsigned long)pendingBaud);
+
+  JsonDocument resp;
+  resp["type"] = "response";
+  resp["command"] = "set-baud";
+  resp["status"] = "success";
+  resp["baud"] = pendingBaud;
+  sendGatewayMessage(resp);
+
+  pendingBaud = 0;
+}
+
+// Fall back to the default rate when the gateway never talked at the new one
+static void checkBaudTimeout() {
+  if (pendingBaud == 0 || millis() - pendingBaudSinceMs < UART2_BAUD_CONFIRM_MS) {
+    return;
+  }
+
+  pendingBaud = 0;
+  resetUART2Baud();
+  LOG_ERROR(LOG_SRC_TRANS, "No traffic at new UART2 baud rate, falling back to %lu", (unsigned long)getUART2Baud());
+
+  JsonDocument resp;
+  resp["type"] = "response";
+  resp["command"] = "set-baud";
+  resp["status"] = "error";
+  resp["baud"] = getUART2Baud();
+  resp["message"] = "No traffic at new baud rate, fell back to default";
+  sendGatewayMessage(resp);
+}
+
+// Collect the TLVs of a FRAME_SEND frame (the payload stays in the line slot)
+static bool parseSendFrame(const uint8_t* frame, size_t frameLength) {
+  static char groupName[ESPNOW_GROUP_NAME_MAX_LEN];
+  binaryTargetCount = 0;
+  binaryGroup = nullptr;
+  binaryPayload = nullptr;
+  binaryPayloadLength = 0;
+  binaryId[0] = '\0';
+
+  size_t offset = 1;
+  uint8_t tag;
+  const uint8_t* value;
+  size_t valueLength;
+  while (frameNextTlv(frame, frameLength, offset, tag, value, valueLength)) {
+    if (tag == TLV_MAC && valueLength == 6 && binaryTargetCount < ESPNOW_MAX_TARGETS) {
+      memcpy(binaryTargets[binaryTargetCount++], value, 6);
+    } else if (tag == TLV_GROUP && valueLength > 0 && valueLength < sizeof(groupName)) {
+      memcpy(groupName, value, valueLength);
+      groupName[valueLength] = '\0';
+      binaryGroup = groupName;
+    } else if (tag == TLV_PAYLOAD) {
+      binaryPayload = (const char*)value;
+      binaryPayloadLength = valueLength;
+    } else if (tag == TLV_ID) {
+      // Same rules as the "id" field of a JSON send; it is echoed into the ack as JSON text
+      JsonDocument idDoc;
+      DeserializationError error = deserializeJson(idDoc, (const char*)value, valueLength);
+      if (error || (!idDoc.is<const char*>() && !idDoc.is<long>()) || measureJson(idDoc) >= sizeof(binaryId)) {
+        LOG_ERROR(LOG_SRC_TRANS, "Send frame ID must be a JSON string or integer below %d bytes", ESPNOW_ID_MAX_LEN);
+        return false;
+      }
+      serializeJson(idDoc, binaryId, sizeof(binaryId));
+    } else {
+      LOG_WARN(LOG_SRC_TRANS, "Ignoring invalid TLV 0x%02X (%u bytes) in send frame", tag, (unsigned)valueLength);
+    }
+  }
+  if (offset != frameLength) {
+    LOG_ERROR(LOG_SRC_TRANS, "Truncated TLV in send frame");
+    return false;
+  }
+  return true;
+}
+
+// Skip a JSON string starting at its opening quote; returns the position after the closing quote
+static const char* skipJsonString(const char* p, const char* end) {
+  for (p++; p < end; p++) {
+    if (*p == '\\') {
+      p++;
+    } else if (*p == '"') {
+      return p + 1;
+    }
+  }
+  return nullptr;
+}
+
+static const char* skipJsonWhitespace(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    p++;
+  }
+  return p;
+}
+
+// Skip any JSON value; returns the position after it, nullptr if it is unterminated
+static const char* skipJsonValue(const char* p, const char* end) {
+  if (p < end && *p == '"') {
+    return skipJsonString(p, end);
+  }
+  if (p < end && (*p == '{' || *p == '[')) {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = skipJsonString(p, end);
+        if (p == nullptr) {
+          return nullptr;
+        }
+        continue;
+      }
+      if (*p == '{' || *p == '[') {
+        depth++;
+      } else if (*p == '}' || *p == ']') {
+        if (--depth == 0) {
+          return p + 1;
+        }
+      }
+      p++;
+    }
+    return nullptr;
+  }
+  // Number, true, false, null
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+    p++;
+  }
+  return p;
+}
+
+// Find the raw text of a top-level member of a JSON object without parsing it.
+// Only locates the span – the caller still validates the syntax of the line.
+static bool findJsonMember(const char* json, size_t length, const char* key,
+                           const char*& value, size_t& valueLength) {
+  const char* end = json + length;
+  size_t keyLength = strlen(key);
+  const char* p = skipJsonWhitespace(json, end);
+  if (p >= end || *p != '{') {
+    return false;
+  }
+  p++;
+
+  while (p < end) {
+    p = skipJsonWhitespace(p, end);
+    if (p >= end || *p != '"') {
       return false;
     }
-    
-    // Silently ignore echoed messages of our own outgoing transmissions
-    if (!doc["type"].isNull()) {
+    const char* name = p + 1;
+    p = skipJsonString(p, end);
+    if (p == nullptr) {
       return false;
     }
-    
+    bool match = (size_t)(p - 1 - name) == keyLength && memcmp(name, key, keyLength) == 0;
+
+    p = skipJsonWhitespace(p, end);
+    if (p >= end || *p != ':') {
+      return false;
+    }
+    p = skipJsonWhitespace(p + 1, end);
+    const char* valueEnd = skipJsonValue(p, end);
+    if (valueEnd == nullptr || valueEnd == p) {
+      return false;
+    }
+    if (match) {
+      value = p;
+      valueLength = valueEnd - p;
+      return true;
+    }
+
+    p = skipJsonWhitespace(valueEnd, end);
+    if (p >= end || *p != ',') {
+      return false;
+    }
+    p++;
+  }
+  return false;
+}
+
+// Parse a JSON message from the gateway. Send messages only get their envelope
+// deserialized; the "message" object is kept as a span of the input, which has
+// to stay untouched until handleSerialMessage() has run.
+static bool parseJsonMessage(const char* json, size_t length) {
+  doc.clear();
+  messageSpan = nullptr;
+  messageSpanLength = 0;
+
+  DeserializationError error;
+  if (findJsonMember(json, length, "message", messageSpan, messageSpanLength)) {
+    // The filter still checks the syntax of the skipped members
+    error = deserializeJson(doc, json, length, DeserializationOption::Filter(envelopeFilter));
+    if (!error && !doc["command"].isNull()) {
+      // Commands need all their fields
+      doc.clear();
+      error = deserializeJson(doc, json, length);
+    }
+  } else {
+    error = deserializeJson(doc, json, length);
+  }
+  if (error) {
+    LOG_ERROR(LOG_SRC_LINK, "deserializeJson() failed: %s", error.c_str());
+    return false;
+  }
+  confirmBaudRate();
+
+  // Silently ignore echoed messages of our own outgoing transmissions
+  return doc["type"].isNull();
+}
+
+// Decode one COBS frame and turn it into either a JSON document or a pending binary send
+static bool parseSerialFrame(uint8_t* frame, size_t length) {
+  int frameLength = frameDecode(frame, length);
+  if (frameLength < 0) {
+    LOG_ERROR(LOG_SRC_LINK, "Dropping corrupted frame (%u bytes)", (unsigned)length);
+    return false;
+  }
+
+  uint8_t type = frame[0];
+  if (type == FRAME_SEND) {
+    if (!parseSendFrame(frame, frameLength)) {
+      return false;
+    }
+    Serial.printf("[TRANS] Frame received from GW on serial: send %u bytes\n", (unsigned)binaryPayloadLength);
+    confirmBaudRate();
+    binarySendPending = true;
     return true;
   }
+
+  if (type != FRAME_JSON) {
+    LOG_ERROR(LOG_SRC_TRANS, "Unknown frame type 0x%02X", type);
+    return false;
+  }
+
+  size_t offset = 1;
+  uint8_t tag;
+  const uint8_t* value;
+  size_t valueLength;
+  if (!frameNextTlv(frame, frameLength, offset, tag, value, valueLength) || tag != TLV_JSON) {
+    LOG_ERROR(LOG_SRC_TRANS, "JSON frame without JSON TLV");
+    return false;
+  }
+
+  Serial.print("[TRANS] Frame received from GW on serial: ");
+  Serial.write(value, valueLength);
+  Serial.println();
+
+  return parseJsonMessage((const char*)value, valueLength);
+}
+
+// Parse one newline-terminated JSON line
+static bool parseSerialLine(const char* line, size_t length) {
+  // Print to USB serial only (to prevent infinite loopback logging)
+  Serial.print("[TRANS] Message received from GW on serial: ");
+  Serial.write((const uint8_t*)line, length);
+  Serial.println();
+  
+  return parseJsonMessage(line, length);
+}
+
+bool readSerialMessage() {
+  checkBaudTimeout();
+  binarySendPending = false;
+
+  uint32_t dropped = linesDropped.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    LOG_WARN(LOG_SRC_TRANS, "Serial line buffer full or line too long, dropped %u lines", dropped);
+  }
+
+  // The previous message (and payloads pointing into it) has been handled by now
+  uint32_t tail = lineTail.load(std::memory_order_relaxed);
+  if (lineHeld) {
+    lineTail.store(++tail, std::memory_order_release);
+    lineHeld = false;
+  }
+
+  // Skip invalid lines until a message is found or the ring is empty
+  while (tail != lineHead.load(std::memory_order_acquire)) {
+    SerialLine& line = lineRing[tail % SERIAL_LINE_SLOTS];
+    bool valid;
+    if (getSerialFraming() == FRAMING_BINARY) {
+      valid = parseSerialFrame(line.data, line.len);
+    } else {
+      valid = parseSerialLine((const char*)line.data, line.len);
+    }
+
+    if (valid) {
+      lineHeld = true;
+      return true;
+    }
+    lineTail.store(++tail, std::memory_order_release);
+  }
   return false;
 }
 
@@ -66,22 +461,31 @@ JsonDocument& getSerialDoc() {
   return doc;
 }
 
-// Handle command messages (ping, reset, set-mac, get-mac)
-// Handle command messages (ping, reset, set-mac, get-mac)
+// Parse an AES key given as 32 or 64 hex characters; returns the key length, -1 if invalid
+static int parseHexKey(const char* text, uint8_t* key) {
+  size_t length = strlen(text);
+  if (length != 32 && length != 64) {
+    return -1;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (!isxdigit((unsigned char)text[i])) {
+      return -1;
+    }
+  }
+  for (size_t i = 0; i < length / 2; i++) {
+    char hex[3] = { text[i * 2], text[i * 2 + 1], '\0' };
+    key[i] = strtol(hex, NULL, 16);
+  }
+  return length / 2;
+}
+
+// Handle command messages (ping, reset, set-mac, get-mac, set-retry, set-peer, remove-peer, set-group, set-framing, set-baud,
+// crypto-bench, set-key, set-peer-crypto, set-peer-compression, probe-peer, set-log, get-journal)
 static void handleCommandMessage(const char* command) {
   if (strcmp(command, "ping") == 0) {
     // Local debug print
-    logPrint("[TRANS] PING response from ");
-    logPrint(WHO_AM_I);
-    logPrint(" - MAC: ");
-    logPrint(WiFi.macAddress());
-    logPrint(", Uptime: ");
-    logPrint(String(millis() / 1000));
-    logPrint("s, Peers: ");
-    logPrint(String(getEspNowPeerCount()));
-    logPrint(", Free Heap: ");
-    logPrint(String(ESP.getFreeHeap()));
-    logPrintln(" bytes");
+    LOG_INFO(LOG_SRC_TRANS, "PING response from %s - MAC: %s, Uptime: %lus, Peers: %d, Free Heap: %u bytes",
+             WHO_AM_I, WiFi.macAddress(), millis() / 1000, getEspNowPeerCount(), ESP.getFreeHeap());
 
     // Gateway response
     JsonDocument resp;
@@ -96,7 +500,7 @@ static void handleCommandMessage(const char* command) {
     sendGatewayMessage(resp);
   } 
   else if (strcmp(command, "reset") == 0) {
-    logPrintln("[TRANS] RESET command received - rebooting device...");
+    LOG_INFO(LOG_SRC_TRANS, "RESET command received - rebooting device...");
     
     // Gateway response
     JsonDocument resp;
@@ -106,14 +510,12 @@ static void handleCommandMessage(const char* command) {
     resp["message"] = "Rebooting device...";
     sendGatewayMessage(resp);
 
-    Serial.flush();
-    getUART2().flush();
+    flushLogs();
     delay(100);
     ESP.restart();
   }
   else if (strcmp(command, "get-mac") == 0) {
-    logPrint("[TRANS] Current MAC address: ");
-    logPrintln(WiFi.macAddress());
+    LOG_INFO(LOG_SRC_TRANS, "Current MAC address: %s", WiFi.macAddress());
 
     // Gateway response
     JsonDocument resp;
@@ -126,7 +528,7 @@ static void handleCommandMessage(const char* command) {
   else if (strcmp(command, "set-mac") == 0) {
     // Check if value field exists
     if (doc["value"].isNull()) {
-      logPrintln("[TRANS] ERROR: 'set-mac' command requires 'value' field");
+      LOG_ERROR(LOG_SRC_TRANS, "'set-mac' command requires 'value' field");
       
       JsonDocument resp;
       resp["type"] = "response";
@@ -139,7 +541,7 @@ static void handleCommandMessage(const char* command) {
     
     const char* newMac = doc["value"];
     if (newMac == nullptr || strlen(newMac) != 12) {
-      logPrintln("[TRANS] ERROR: MAC address must be 12 hex characters (e.g., 'AABBCCDDEEFF')");
+      LOG_ERROR(LOG_SRC_TRANS, "MAC address must be 12 hex characters (e.g., 'AABBCCDDEEFF')");
       
       JsonDocument resp;
       resp["type"] = "response";
@@ -162,13 +564,9 @@ static void handleCommandMessage(const char* command) {
     
     // Set the custom MAC address
     if (setCustomMacAddress(macBytes)) {
-      logPrint("[TRANS] MAC address set to: ");
-      for (int i = 0; i < 6; i++) {
-        if (macBytes[i] < 16) logPrint("0");
-        logPrint(String(macBytes[i], HEX));
-      }
-      logPrintln("");
-      logPrintln("[TRANS] Rebooting to apply new MAC address...");
+      LOG_INFO(LOG_SRC_TRANS, "MAC address set to: %02x%02x%02x%02x%02x%02x",
+               macBytes[0], macBytes[1], macBytes[2], macBytes[3], macBytes[4], macBytes[5]);
+      LOG_INFO(LOG_SRC_TRANS, "Rebooting to apply new MAC address...");
 
       // Gateway response
       JsonDocument resp;
@@ -179,12 +577,11 @@ static void handleCommandMessage(const char* command) {
       resp["message"] = "Rebooting to apply new MAC address";
       sendGatewayMessage(resp);
 
-      Serial.flush();
-      getUART2().flush();
+      flushLogs();
       delay(100);
       ESP.restart();
     } else {
-      logPrintln("[TRANS] ERROR: Failed to set MAC address");
+      LOG_ERROR(LOG_SRC_TRANS, "Failed to set MAC address");
 
       JsonDocument resp;
       resp["type"] = "response";
@@ -194,9 +591,442 @@ static void handleCommandMessage(const char* command) {
       sendGatewayMessage(resp);
     }
   }
+  else if (strcmp(command, "set-retry") == 0) {
+    // Optional "mac" selects one peer, otherwise the default policy is changed
+    uint8_t macBytes[6];
+    const char* macField = doc["mac"];
+    if (macField != nullptr && !parseMacAddress(macField, macBytes)) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-retry' MAC address must be 12 hex characters");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-retry";
+      resp["status"] = "error";
+      resp["message"] = "MAC address must be 12 hex characters (e.g., 'AABBCCDDEEFF')";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    // Omitted fields keep their current value
+    RetryPolicy current = getRetryPolicy(macField != nullptr ? macBytes : nullptr);
+    int attempts = doc["attempts"] | (int)current.maxAttempts;
+    int backoffMs = doc["backoff_ms"] | (int)current.backoffMs;
+    int backoffMaxMs = doc["backoff_max_ms"] | (int)current.backoffMaxMs;
+    if (attempts < 1 || attempts > 10 || backoffMs < 1 || backoffMaxMs < backoffMs || backoffMaxMs > 10000) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-retry' values out of range");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-retry";
+      resp["status"] = "error";
+      resp["message"] = "Expected attempts 1-10 and 1 <= backoff_ms <= backoff_max_ms <= 10000";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    RetryPolicy policy = { (uint8_t)attempts, (uint16_t)backoffMs, (uint16_t)backoffMaxMs };
+    bool ok = setRetryPolicy(macField != nullptr ? macBytes : nullptr, policy);
+    LOG_INFO(LOG_SRC_TRANS, "Retry policy for %s: %d attempts, backoff %d-%d ms",
+              macField != nullptr ? macField : "default", attempts, backoffMs, backoffMaxMs);
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-retry";
+    resp["status"] = ok ? "success" : "error";
+    resp["mac"] = macField != nullptr ? macField : "default";
+    resp["attempts"] = attempts;
+    resp["backoff_ms"] = backoffMs;
+    resp["backoff_max_ms"] = backoffMaxMs;
+    if (!ok) {
+      resp["message"] = "Failed to register peer";
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-peer") == 0 || strcmp(command, "remove-peer") == 0) {
+    uint8_t macBytes[6];
+    const char* macField = doc["mac"];
+    int channel = doc["channel"] | 0;
+    int frameMax = doc["frame_max"] | -1;
+    int coalesceMs = doc["coalesce_ms"] | -1;
+    if (!parseMacAddress(macField, macBytes) || channel < 0 || channel > 14 ||
+        (frameMax != -1 && frameMax != 0 && (frameMax < ESPNOW_V1_FRAME_MAX || frameMax > ESPNOW_FRAME_MAX)) ||
+        coalesceMs < -1 || coalesceMs > 100) {
+      LOG_ERROR(LOG_SRC_TRANS, "'%s' requires a 12 hex character 'mac' (and 'channel' 0-14, 'frame_max' %d-%d, 'coalesce_ms' 0-100)",
+                command, ESPNOW_V1_FRAME_MAX, ESPNOW_FRAME_MAX);
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = command;
+      resp["status"] = "error";
+      resp["message"] = "Invalid 'mac', 'channel', 'frame_max' or 'coalesce_ms' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    bool ok;
+    if (strcmp(command, "set-peer") == 0) {
+      ok = setPeerChannel(macBytes, channel);
+      // Omitted frame_max / coalesce_ms keep their current value
+      if (ok && frameMax != -1) {
+        ok = setPeerFrameMax(macBytes, frameMax);
+      }
+      if (ok && coalesceMs != -1) {
+        ok = setPeerCoalescing(macBytes, coalesceMs);
+      }
+      LOG_INFO(LOG_SRC_TRANS, "Peer %s set to channel %d, frames up to %u bytes, coalescing %u ms",
+                macField, channel, getPeerFrameMax(macBytes), getPeerCoalescing(macBytes));
+    } else {
+      ok = removePeer(macBytes);
+      LOG_INFO(LOG_SRC_TRANS, "Peer %s %s", macField, ok ? "removed" : "not found");
+    }
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = command;
+    resp["status"] = ok ? "success" : "error";
+    resp["mac"] = macField;
+    resp["peers"] = getEspNowPeerCount();
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-group") == 0) {
+    const char* name = doc["name"];
+    uint8_t probe[6];
+    if (name == nullptr || strlen(name) == 0 || strlen(name) >= ESPNOW_GROUP_NAME_MAX_LEN || parseMacAddress(name, probe)) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-group' requires a 'name' of 1-15 characters that is not a MAC address");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-group";
+      resp["status"] = "error";
+      resp["message"] = "Invalid 'name' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    // Members use the same validation as an array "to" field
+    static uint8_t members[ESPNOW_MAX_TARGETS][6];
+    int memberCount = 0;
+    if (!doc["members"].isNull()) {
+      memberCount = doc["members"].is<JsonArray>() ? resolveEspNowTargets(doc["members"], members) : -1;
+    }
+    if (memberCount < 0) {
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-group";
+      resp["status"] = "error";
+      resp["message"] = "'members' must be an array of 12-hex MAC addresses";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    bool ok = setPeerGroup(name, members, memberCount);
+    if (ok) {
+      LOG_INFO(LOG_SRC_TRANS, "Group '%s' set to %d peers", name, memberCount);
+    }
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-group";
+    resp["status"] = ok ? "success" : "error";
+    resp["name"] = name;
+    resp["members"] = memberCount;
+    if (!ok) {
+      resp["message"] = "Failed to store group";
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-framing") == 0) {
+    const char* mode = doc["mode"];
+    SerialFraming framing;
+    if (mode != nullptr && strcmp(mode, "binary") == 0) {
+      framing = FRAMING_BINARY;
+    } else if (mode != nullptr && strcmp(mode, "json") == 0) {
+      framing = FRAMING_JSON;
+    } else {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-framing' requires 'mode' of 'json' or 'binary'");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-framing";
+      resp["status"] = "error";
+      resp["message"] = "Invalid 'mode' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    // The response still uses the old framing so the gateway can read it,
+    // everything after it uses the new one
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-framing";
+    resp["status"] = "success";
+    resp["mode"] = mode;
+    sendGatewayMessage(resp);
+
+    setUART2Framing(framing);
+    LOG_INFO(LOG_SRC_TRANS, "Serial framing set to %s", mode);
+  }
+  else if (strcmp(command, "set-baud") == 0) {
+    uint32_t baud = doc["baud"] | 0UL;
+    bool supported = false;
+    for (uint32_t rate : SUPPORTED_BAUD_RATES) {
+      supported = supported || rate == baud;
+    }
+    if (!supported) {
+      LOG_ERROR(LOG_SRC_TRANS, "Unsupported UART2 baud rate %lu", (unsigned long)baud);
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-baud";
+      resp["status"] = "error";
+      resp["baud"] = getUART2Baud();
+      resp["message"] = "Unsupported 'baud' value";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    if (baud == getUART2Baud()) {
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-baud";
+      resp["status"] = "success";
+      resp["baud"] = baud;
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    // Answer at the current rate, then switch and wait for the gateway to follow
+    LOG_INFO(LOG_SRC_TRANS, "Switching UART2 to %lu baud", (unsigned long)baud);
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-baud";
+    resp["status"] = "pending";
+    resp["baud"] = baud;
+    resp["timeout_ms"] = UART2_BAUD_CONFIRM_MS;
+    sendGatewayMessage(resp);
+
+    setUART2Baud(baud, false);
+    pendingBaud = baud;
+    pendingBaudSinceMs = millis();
+  }
+  else if (strcmp(command, "crypto-bench") == 0) {
+    int frameBytes = doc["bytes"] | 200;
+    int iterations = doc["iterations"] | 200;
+    if (frameBytes < 1 || frameBytes > 250 || iterations < 1 || iterations > 2000) {
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "crypto-bench";
+      resp["status"] = "error";
+      resp["message"] = "Expected bytes 1-250 and iterations 1-2000";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    CryptoBenchResult results[4];
+    int count = benchmarkCrypto(results, 4, frameBytes, iterations);
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "crypto-bench";
+    resp["status"] = "success";
+    resp["active"] = getCryptoBackend()->name;
+    resp["bytes"] = frameBytes;
+    resp["iterations"] = iterations;
+    JsonArray backends = resp["backends"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+      JsonObject entry = backends.add<JsonObject>();
+      entry["name"] = results[i].name;
+      entry["us_per_frame"] = roundf(results[i].usPerFrame * 10) / 10;
+      LOG_INFO(LOG_SRC_TRANS, "AES-CTR %s: %.1f us per %d byte frame", results[i].name, results[i].usPerFrame, frameBytes);
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-key") == 0) {
+    // The key itself is never logged or echoed back
+    int slot = doc["slot"] | -1;
+    const char* keyField = doc["key"];
+    uint8_t keyBytes[32];
+    int keyLength = keyField != nullptr && keyField[0] == '\0' ? 0 :
+                    keyField != nullptr ? parseHexKey(keyField, keyBytes) : -1;
+    if (slot < 1 || slot >= CRYPTO_KEY_SLOTS || keyLength < 0) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-key' requires 'slot' 1-%d and 'key' of 32 or 64 hex characters", CRYPTO_KEY_SLOTS - 1);
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-key";
+      resp["status"] = "error";
+      resp["message"] = "Invalid 'slot' or 'key' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    bool ok = setCryptoKey(slot, keyBytes, keyLength);
+    LOG_INFO(LOG_SRC_TRANS, "Key slot %d %s", slot, keyLength > 0 ? "set" : "cleared");
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-key";
+    resp["status"] = ok ? "success" : "error";
+    resp["slot"] = slot;
+    if (!ok) {
+      resp["message"] = "Failed to write key to NVS";
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-peer-crypto") == 0) {
+    uint8_t macBytes[6];
+    const char* macField = doc["mac"];
+    int mode = parseCryptoMode(doc["mode"] | "default");
+    int keySlot = doc["key_slot"] | 0;
+    if (!parseMacAddress(macField, macBytes) || mode < 0 || keySlot < 0 || keySlot >= CRYPTO_KEY_SLOTS) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-peer-crypto' requires 'mac', 'mode' (default, plaintext, ctr, aead) and a valid 'key_slot'");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-peer-crypto";
+      resp["status"] = "error";
+      resp["message"] = "Invalid 'mac', 'mode' or 'key_slot' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    PeerCrypto crypto = { (uint8_t)mode, (uint8_t)keySlot };
+    bool ok = setPeerCrypto(macBytes, crypto);
+    LOG_INFO(LOG_SRC_TRANS, "Peer %s uses %s encryption with key slot %d", macField, cryptoModeName(mode), keySlot);
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-peer-crypto";
+    resp["status"] = ok ? "success" : "error";
+    resp["mac"] = macField;
+    resp["mode"] = cryptoModeName(mode);
+    resp["key_slot"] = keySlot;
+    if (ok && resolvePeerCrypto(macBytes).mode != CRYPTO_MODE_PLAINTEXT && !isCryptoKeySet(keySlot)) {
+      resp["warning"] = "Key slot is empty - frames to this peer are rejected until it is set";
+    } else if (!ok) {
+      resp["message"] = "Failed to register peer";
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-peer-compression") == 0) {
+    uint8_t macBytes[6];
+    const char* macField = doc["mac"];
+    if (!parseMacAddress(macField, macBytes) || !doc["enabled"].is<bool>()) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-peer-compression' requires a 12 hex character 'mac' and boolean 'enabled'");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-peer-compression";
+      resp["status"] = "error";
+      resp["message"] = "Invalid 'mac' or 'enabled' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    bool enabled = doc["enabled"];
+    bool ok = setPeerCompression(macBytes, enabled);
+    LOG_INFO(LOG_SRC_TRANS, "Compression for peer %s %s", macField, enabled ? "enabled" : "disabled");
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-peer-compression";
+    resp["status"] = ok ? "success" : "error";
+    resp["mac"] = macField;
+    resp["enabled"] = enabled;
+    if (!ok) {
+      resp["message"] = "Failed to register peer";
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "probe-peer") == 0) {
+    uint8_t macBytes[6];
+    const char* macField = doc["mac"];
+    bool valid = parseMacAddress(macField, macBytes);
+    bool ok = valid && getCurrentState() != STATE_WIFI && probeEspNowPeer(macBytes);
+    if (ok) {
+      LOG_INFO(LOG_SRC_TRANS, "Frame size probe sent to %s", macField);
+    } else {
+      LOG_ERROR(LOG_SRC_TRANS, "Failed to send frame size probe");
+    }
+
+    // The result follows as a second response when the peer answers
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "probe-peer";
+    resp["status"] = ok ? "pending" : "error";
+    if (valid) {
+      resp["mac"] = macField;
+    }
+    if (!ok) {
+      resp["message"] = !valid ? "Invalid 'mac' field" :
+                        getCurrentState() == STATE_WIFI ? "ESP-NOW is not running" :
+                        "ESP-NOW v2 is not supported by this build or the TX queue is full";
+    }
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "set-log") == 0) {
+    // Every field is optional, a bare "set-log" reports the current settings
+    LogSinkConfig config = getLogSinkConfig();
+    int usbLevel = doc["usb_level"].is<const char*>() ? parseLogLevel(doc["usb_level"]) : config.usbLevel;
+    int uartLevel = doc["uart_level"].is<const char*>() ? parseLogLevel(doc["uart_level"]) : config.uartLevel;
+    int journalLevel = doc["journal_level"].is<const char*>() ? parseLogLevel(doc["journal_level"]) : config.journalLevel;
+    uint32_t uartRate = doc["uart_rate"] | (uint32_t)config.uartRate;
+    uint32_t uartBurst = doc["uart_burst"] | (uint32_t)config.uartBurst;
+    if (usbLevel < 0 || uartLevel < 0 || journalLevel < 0 || uartRate > 1000 || uartBurst < 1 || uartBurst > 1000) {
+      LOG_ERROR(LOG_SRC_TRANS, "'set-log' requires levels of debug/info/warning/error, 'uart_rate' 0-1000 and 'uart_burst' 1-1000");
+
+      JsonDocument resp;
+      resp["type"] = "response";
+      resp["command"] = "set-log";
+      resp["status"] = "error";
+      resp["message"] = "Invalid level, 'uart_rate' or 'uart_burst' field";
+      sendGatewayMessage(resp);
+      return;
+    }
+
+    config.usbLevel = usbLevel;
+    config.uartLevel = uartLevel;
+    config.uartRate = uartRate;
+    config.uartBurst = uartBurst;
+    config.journalLevel = journalLevel;
+    setLogSinkConfig(config);
+    LOG_INFO(LOG_SRC_TRANS, "Log sinks: USB %s, UART2 %s at %u lines/s (burst %u), journal %s",
+             logLevelName(config.usbLevel), logLevelName(config.uartLevel), config.uartRate, config.uartBurst,
+             logLevelName(config.journalLevel));
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "set-log";
+    resp["status"] = "success";
+    resp["usb_level"] = logLevelName(config.usbLevel);
+    resp["uart_level"] = logLevelName(config.uartLevel);
+    resp["uart_rate"] = config.uartRate;
+    resp["uart_burst"] = config.uartBurst;
+    resp["journal_level"] = logLevelName(config.journalLevel);
+    resp["uart_dropped"] = getUartLogDropped();
+    sendGatewayMessage(resp);
+  }
+  else if (strcmp(command, "get-journal") == 0) {
+    // A few entries per response keep it within one binary frame
+    uint32_t page = doc["page"] | 0UL;
+    size_t offset = doc["offset"] | 0U;
+
+    JsonDocument resp;
+    resp["type"] = "response";
+    resp["command"] = "get-journal";
+    if (getJournalPage(page, offset, JOURNAL_SERIAL_ENTRIES, resp.as<JsonObject>())) {
+      resp["status"] = "success";
+    } else {
+      LOG_ERROR(LOG_SRC_TRANS, "Journal page %u not found", page);
+      resp["status"] = "error";
+      resp["page"] = page;
+      resp["message"] = "No such journal page";
+    }
+    sendGatewayMessage(resp);
+  }
   else {
-    logPrint("[TRANS] ERROR: Unknown command: ");
-    logPrintln(command);
+    LOG_ERROR(LOG_SRC_TRANS, "Unknown command: %s", command);
 
     JsonDocument resp;
     resp["type"] = "response";
@@ -207,7 +1037,46 @@ static void handleCommandMessage(const char* command) {
   }
 }
 
+// Send the payload of a FRAME_SEND frame as-is
+static void handleBinarySend() {
+  if (binaryPayload == nullptr || binaryPayloadLength == 0) {
+    LOG_ERROR(LOG_SRC_TRANS, "Missing payload TLV in send frame");
+    return;
+  }
+
+  // Group members are appended to the explicit MAC TLVs
+  int targetCount = binaryTargetCount;
+  if (binaryGroup != nullptr) {
+    static uint8_t members[ESPNOW_MAX_TARGETS][6];
+    int memberCount = getPeerGroupMembers(binaryGroup, members);
+    if (memberCount < 0) {
+      LOG_ERROR(LOG_SRC_TRANS, "Unknown group in send frame: %s", binaryGroup);
+      return;
+    }
+    for (int i = 0; i < memberCount && targetCount < ESPNOW_MAX_TARGETS; i++) {
+      memcpy(binaryTargets[targetCount++], members[i], 6);
+    }
+  }
+  if (targetCount == 0) {
+    LOG_ERROR(LOG_SRC_TRANS, "Send frame does not contain any target");
+    return;
+  }
+
+  if (getCurrentState() == STATE_WIFI) {
+    LOG_DEBUG(LOG_SRC_DRY_RUN, "Would send to %d peers: %s", targetCount, LogSpan{(const char*)binaryPayload, binaryPayloadLength});
+    sendEspNowDryRunAck(binaryId);
+    return;
+  }
+
+  sendEspNowMessage(binaryTargets, targetCount, binaryPayload, binaryPayloadLength, binaryId);
+}
+
 void handleSerialMessage() {
+  if (binarySendPending) {
+    handleBinarySend();
+    return;
+  }
+
   // Check if this is a command message (ping, reset, etc.)
   if (!doc["command"].isNull()) {
     const char* command = doc["command"];
@@ -219,35 +1088,56 @@ void handleSerialMessage() {
   
   // Validate required JSON fields for ESP-NOW messages
   if (doc["to"].isNull()) {
-    logPrintln("[TRANS] ERROR: Missing 'to' field in JSON");
+    LOG_ERROR(LOG_SRC_TRANS, "Missing 'to' field in JSON");
     return;
   }
   
-  if (doc["message"].isNull()) {
-    logPrintln("[TRANS] ERROR: Missing 'message' field in JSON");
+  if (messageSpan == nullptr) {
+    LOG_ERROR(LOG_SRC_TRANS, "Missing 'message' field in JSON");
     return;
   }
   
-  const char* toField = doc["to"];
-  if (toField == nullptr || strlen(toField) != 12) {
-    logPrintln("[TRANS] ERROR: Invalid 'to' field - must be 12 hex characters");
+  // Single MAC, broadcast, group name or array of MACs
+  static uint8_t targets[ESPNOW_MAX_TARGETS][6];
+  int targetCount = resolveEspNowTargets(doc["to"], targets);
+  if (targetCount < 0) {
+    return;
+  }
+  if (targetCount == 0) {
+    LOG_ERROR(LOG_SRC_TRANS, "'to' field does not contain any target");
     return;
   }
   
-  // Get the message object and send via ESP-NOW
-  JsonObject messageObj = doc["message"];
-  if (messageObj.isNull()) {
-    logPrintln("[TRANS] ERROR: 'message' field is not a valid object");
+  // The message object is sent exactly as received
+  if (*messageSpan != '{') {
+    LOG_ERROR(LOG_SRC_TRANS, "'message' field is not a valid object");
     return;
   }
   
+  // Optional correlation ID, echoed back in the "ack" message
+  char id[ESPNOW_ID_MAX_LEN] = "";
+  if (!doc["id"].isNull()) {
+    if (!doc["id"].is<const char*>() && !doc["id"].is<long>()) {
+      LOG_ERROR(LOG_SRC_TRANS, "'id' field must be a string or an integer");
+      return;
+    }
+    if (measureJson(doc["id"]) >= sizeof(id)) {
+      LOG_ERROR(LOG_SRC_TRANS, "'id' field is too long");
+      return;
+    }
+    serializeJson(doc["id"], id, sizeof(id));
+  }
+  
   // Check if we are in Wi-Fi Mode
   if (getCurrentState() == STATE_WIFI) {
-    String msgStr;
-    serializeJson(messageObj, msgStr);
-    logPrintf("[DRY RUN] Would send to %s: %s\n", toField, msgStr.c_str());
+    if (doc["to"].is<const char*>()) {
+      LOG_DEBUG(LOG_SRC_DRY_RUN, "Would send to %s: %s", doc["to"].as<const char*>(), LogSpan{(const char*)messageSpan, messageSpanLength});
+    } else {
+      LOG_DEBUG(LOG_SRC_DRY_RUN, "Would send to %d peers: %s", targetCount, LogSpan{(const char*)messageSpan, messageSpanLength});
+    }
+    sendEspNowDryRunAck(id);
     return;
   }
   
-  sendEspNowMessage(toField, messageObj);
+  sendEspNowMessage(targets, targetCount, messageSpan, messageSpanLength, id);
 }
@@ -1,6 +1,7 @@
 #include "wifi_web_handler.h"
 #include "config.h"
 #include "logger.h"
+#include "journal.h"
 #include "espnow_handler.h"
 #include "led_handler.h"
 #include <WiFi.h>
@@ -450,7 +451,7 @@ static const char INDEX_HTML[] PROGMEM = R"rawliteral(
 )rawliteral";
 
 void setupWifiWeb() {
-  logPrintln("[TRANS] Starting Wi-Fi Setup Mode...");
+  LOG_INFO(LOG_SRC_TRANS, "Starting Wi-Fi Setup Mode...");
   
   setLedPattern(LED_WIFI_MODE);
   
@@ -461,7 +462,7 @@ void setupWifiWeb() {
   WiFi.mode(WIFI_STA);
   WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
   
-  logPrintf("[TRANS] Connecting to Wi-Fi SSID: %s\n", WIFI_SSID);
+  LOG_INFO(LOG_SRC_TRANS, "Connecting to Wi-Fi SSID: %s", WIFI_SSID);
   
   // Non-blocking connection wait (up to 15 seconds)
   // Feed watchdog here: this function can be called from loop() via transitionToWifi()
@@ -469,15 +470,13 @@ void setupWifiWeb() {
   while (WiFi.status() != WL_CONNECTED && millis() - startConnect < 15000) {
     feedWatchdog();
     delay(500);
-    logPrint(".");
   }
-  logPrintln();
 
   if (WiFi.status() == WL_CONNECTED) {
-    logPrintln("[TRANS] Wi-Fi connected successfully!");
-    logPrintf("[TRANS] IP Address: %s\n", WiFi.localIP().toString().c_str());
+    LOG_INFO(LOG_SRC_TRANS, "Wi-Fi connected successfully!");
+    LOG_INFO(LOG_SRC_TRANS, "IP Address: %s", WiFi.localIP().toString().c_str());
   } else {
-    logPrintln("[TRANS] WARNING: Wi-Fi connection failed/timed out. Continuing in offline setup mode.");
+    LOG_WARN(LOG_SRC_TRANS, "Wi-Fi connection failed/timed out. Continuing in offline setup mode.");
   }
   // Setup Web Server Routes
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -488,6 +487,19 @@ void setupWifiWeb() {
     request->send(200, "application/json", getLogsJson());
   });
 
+  // Flash journal, one block per page (?page=0 is the newest)
+  server.on("/api/journal", HTTP_GET, [](AsyncWebServerRequest *request) {
+    uint32_t page = request->hasParam("page") ? request->getParam("page")->value().toInt() : 0;
+    JsonDocument doc;
+    if (!getJournalPage(page, 0, JOURNAL_BLOCK_BYTES, doc.to<JsonObject>())) {
+      request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"No such journal page\"}");
+      return;
+    }
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
   server.on("/api/clear-logs", HTTP_POST, [](AsyncWebServerRequest *request) {
     clearLogBuffer();
     request->send(200, "application/json", "{\"status\":\"ok\"}");
@@ -552,11 +564,11 @@ void setupWifiWeb() {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
         return;
       }
-      // Re-serialize (compact) and write to UART2
+      // Re-serialize (compact) and write to UART2 in the active framing
       String out;
       serializeJson(jsonDoc, out);
-      getUART2().println(out);
-      logPrintf("[TRANS] Web -> UART2 raw send: %s\n", out.c_str());
+      sendGatewayMessage(jsonDoc);
+      LOG_INFO(LOG_SRC_TRANS, "Web -> UART2 raw send: %s", out.c_str());
       request->send(200, "application/json", "{\"status\":\"ok\"}");
     });
 
@@ -567,7 +579,8 @@ void setupWifiWeb() {
     response->addHeader("Connection", "close");
     request->send(response);
     if (shouldReboot) {
-      logPrintln("[TRANS] OTA firmware flash successful. Rebooting...");
+      LOG_INFO(LOG_SRC_TRANS, "OTA firmware flash successful. Rebooting...");
+      flushLogs();
       delay(500);
       ESP.restart();
     }
@@ -575,7 +588,7 @@ void setupWifiWeb() {
     feedWatchdog();
     if (!index) {
       setLedPattern(LED_OTA_BLINK);
-      logPrintf("[TRANS] OTA Web Update Started: %s\n", filename.c_str());
+      LOG_INFO(LOG_SRC_TRANS, "OTA Web Update Started: %s", filename.c_str());
       // Shut down watchdog or feed it during update
       if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
         Update.printError(Serial);
@@ -588,7 +601,7 @@ void setupWifiWeb() {
     }
     if (final) {
       if (Update.end(true)) {
-        logPrintf("[TRANS] OTA Web Update Completed: %u bytes\n", index + len);
+        LOG_INFO(LOG_SRC_TRANS, "OTA Web Update Completed: %u bytes", index + len);
       } else {
         Update.printError(Serial);
       }
@@ -596,33 +609,39 @@ void setupWifiWeb() {
   });
 
   server.begin();
-  logPrintln("[TRANS] HTTP server started on port 80");
+  LOG_INFO(LOG_SRC_TRANS, "HTTP server started on port 80");
 
   // Setup ArduinoOTA (for network flashing via IDE/PlatformIO)
   ArduinoOTA.setHostname(WHO_AM_I);
   ArduinoOTA.onStart([]() {
     feedWatchdog();
     setLedPattern(LED_OTA_BLINK);
-    logPrintln("[TRANS] ArduinoOTA Update Start");
+    LOG_INFO(LOG_SRC_TRANS, "ArduinoOTA Update Start");
   });
   ArduinoOTA.onEnd([]() {
     feedWatchdog();
-    logPrintln("\n[TRANS] ArduinoOTA Update End");
+    LOG_INFO(LOG_SRC_TRANS, "ArduinoOTA Update End");
   });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
     feedWatchdog();
-    logPrintf("[TRANS] ArduinoOTA Progress: %u%%\r", (progress / (total / 100)));
+    // One line per 10 %, a record per callback would flood the log
+    static unsigned int lastStep = 0;
+    unsigned int percent = progress / (total / 100);
+    if (percent / 10 != lastStep) {
+      lastStep = percent / 10;
+      LOG_DEBUG(LOG_SRC_TRANS, "ArduinoOTA Progress: %u%%", percent);
+    }
   });
   ArduinoOTA.onError([](ota_error_t error) {
-    logPrintf("[TRANS] ArduinoOTA Error[%u]: ", error);
-    if (error == OTA_AUTH_ERROR) logPrintln("Auth Failed");
-    else if (error == OTA_BEGIN_ERROR) logPrintln("Begin Failed");
-    else if (error == OTA_CONNECT_ERROR) logPrintln("Connect Failed");
-    else if (error == OTA_RECEIVE_ERROR) logPrintln("Receive Failed");
-    else if (error == OTA_END_ERROR) logPrintln("End Failed");
+    const char* reason = error == OTA_AUTH_ERROR ? "Auth Failed" :
+                         error == OTA_BEGIN_ERROR ? "Begin Failed" :
+                         error == OTA_CONNECT_ERROR ? "Connect Failed" :
+                         error == OTA_RECEIVE_ERROR ? "Receive Failed" :
+                         error == OTA_END_ERROR ? "End Failed" : "";
+    LOG_ERROR(LOG_SRC_TRANS, "ArduinoOTA Error[%u]: %s", (unsigned)error, reason);
   });
   ArduinoOTA.begin();
-  logPrintln("[TRANS] ArduinoOTA listener started");
+  LOG_INFO(LOG_SRC_TRANS, "ArduinoOTA listener started");
 }
 
 void handleWifiWeb() {
@@ -634,14 +653,14 @@ void handleWifiWeb() {
   // If dry run is active, timer is disabled
   if (!dryRunMode) {
     if (millis() >= wifiTimeoutExpirationMs) {
-      logPrintln("[TRANS] Wi-Fi Mode timeout expired. Auto-switching to ESP-NOW...");
+      LOG_INFO(LOG_SRC_TRANS, "Wi-Fi Mode timeout expired. Auto-switching to ESP-NOW...");
       transitionToEspNow();
     }
   }
 }
 
 void stopWifiWeb() {
-  logPrintln("[TRANS] Stopping Web Server & OTA...");
+  LOG_INFO(LOG_SRC_TRANS, "Stopping Web Server & OTA...");
   server.end();
   // ArduinoOTA does not have a clean end() method on ESP32, but we stop calling handle()
 }
@@ -651,7 +670,7 @@ void transitionToEspNow() {
 
   stopWifiWeb();
 
-  logPrintln("[TRANS] Resetting Wi-Fi stack for ESP-NOW...");
+  LOG_INFO(LOG_SRC_TRANS, "Resetting Wi-Fi stack for ESP-NOW...");
   WiFi.disconnect(true, true);
   delay(100);
   WiFi.mode(WIFI_OFF);
@@ -667,13 +686,13 @@ void transitionToEspNow() {
   setLedPattern(LED_ESPNOW_MODE);
   
   currentState = STATE_ESPNOW;
-  logPrintln("[TRANS] Transited to ESP-NOW mode successfully.");
+  LOG_INFO(LOG_SRC_TRANS, "Transited to ESP-NOW mode successfully.");
 }
 
 void transitionToWifi() {
   if (currentState == STATE_WIFI) return;
 
-  logPrintln("[TRANS] Button triggered: switching back to Wi-Fi mode...");
+  LOG_INFO(LOG_SRC_TRANS, "Button triggered: switching back to Wi-Fi mode...");
 
   // Tear down ESP-NOW
   esp_now_deinit();
@@ -693,7 +712,7 @@ void transitionToWifi() {
   setDryRunMode(true);
 
   currentState = STATE_WIFI;  // must be set AFTER setupWifiWeb() to reflect actual state
-  logPrintln("[TRANS] Transited to Wi-Fi mode (no timeout – toggled manually).");
+  LOG_INFO(LOG_SRC_TRANS, "Transited to Wi-Fi mode (no timeout – toggled manually).");
 }
 
 DeviceState getCurrentState() {
@@ -706,12 +725,12 @@ bool isDryRunEnabled() {
 
 void prolongWifiTime(uint32_t ms) {
   wifiTimeoutExpirationMs = millis() + ms;
-  logPrintf("[TRANS] Wi-Fi Mode prolonged by %u seconds.\n", ms / 1000);
+  LOG_INFO(LOG_SRC_TRANS, "Wi-Fi Mode prolonged by %u seconds.", ms / 1000);
 }
 
 void setDryRunMode(bool enable) {
   dryRunMode = enable;
-  logPrintf("[TRANS] Dry Run Mode set to: %s\n", dryRunMode ? "ENABLED" : "DISABLED");
+  LOG_INFO(LOG_SRC_TRANS, "Dry Run Mode set to: %s", dryRunMode ? "ENABLED" : "DISABLED");
 }
 
 int32_t getRemainingWifiTimeSec() {